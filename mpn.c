@@ -372,6 +372,19 @@ extern void __gmpn_binvert(mp_limb_t *rp, const mp_limb_t *up, mp_size_t n,
                            mp_limb_t *scratch);
 extern void __gmpn_mullo_n(mp_limb_t *rp, const mp_limb_t *xp,
                            const mp_limb_t *yp, mp_size_t n);
+extern void __gmpn_divexact(mp_limb_t *qp, const mp_limb_t *np, mp_size_t nn,
+                            const mp_limb_t *dp, mp_size_t dn);
+extern mp_limb_t __gmpn_sbpi1_div_qr(mp_limb_t *qp, mp_limb_t *np,
+                                     mp_size_t nn, const mp_limb_t *dp,
+                                     mp_size_t dn, mp_limb_t dinv);
+extern mp_limb_t __gmpn_redc_1(mp_limb_t *rp, mp_limb_t *up,
+                               const mp_limb_t *mp, mp_size_t n,
+                               mp_limb_t invm);
+/* The last argument is a pointer to gmp_pi1_t, that is a structure with
+   single mp_limb_t field. */
+extern mp_limb_t __gmpn_dcpi1_div_qr(mp_limb_t *qp, mp_limb_t *np,
+                                     mp_size_t nn, const mp_limb_t *dp,
+                                     mp_size_t dn, const mp_limb_t *dinv);
 
 void mpn_powm(mp_limb_t *rp, const mp_limb_t *bp, mp_size_t bn,
               const mp_limb_t *ep, mp_size_t en, const mp_limb_t *mp,
@@ -404,6 +417,30 @@ void mpn_mullo_n(mp_limb_t *rp, const mp_limb_t *xp,
     __gmpn_mullo_n(rp, xp, yp, n);
 }
 
+void mpn_divexact(mp_limb_t *qp, const mp_limb_t *np, mp_size_t nn,
+                  const mp_limb_t *dp, mp_size_t dn)
+{
+    __gmpn_divexact(qp, np, nn, dp, dn);
+}
+
+mp_limb_t mpn_sbpi1_div_qr(mp_limb_t *qp, mp_limb_t *np, mp_size_t nn,
+                           const mp_limb_t *dp, mp_size_t dn, mp_limb_t dinv)
+{
+    return __gmpn_sbpi1_div_qr(qp, np, nn, dp, dn, dinv);
+}
+
+mp_limb_t mpn_dcpi1_div_qr(mp_limb_t *qp, mp_limb_t *np, mp_size_t nn,
+                           const mp_limb_t *dp, mp_size_t dn, mp_limb_t dinv)
+{
+    return __gmpn_dcpi1_div_qr(qp, np, nn, dp, dn, &dinv);
+}
+
+mp_limb_t mpn_redc_1(mp_limb_t *rp, mp_limb_t *up, const mp_limb_t *mp,
+                     mp_size_t n, mp_limb_t invm)
+{
+    return __gmpn_redc_1(rp, up, mp, n, invm);
+}
+
 extern double __gmpn_get_d(const mp_limb_t *up, mp_size_t size,
                            mp_size_t sign, long exp);
 
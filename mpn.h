@@ -44,6 +44,30 @@ void mpn_binvert(mp_limb_t *rp, const mp_limb_t *up, mp_size_t n,
 void mpn_mullo_n(mp_limb_t *rp, const mp_limb_t *xp,
                  const mp_limb_t *yp, mp_size_t n);
 
+/* Compute q = n/d, if the division is exact (otherwise, q is unspecified).
+   Requires nn >= dn > 0 and non-zero dp[dn-1].  Writes nn - dn + 1 limbs
+   to qp, which must not overlap inputs. */
+void mpn_divexact(mp_limb_t *qp, const mp_limb_t *np, mp_size_t nn,
+                  const mp_limb_t *dp, mp_size_t dn);
+
+/* Divide {np, nn} by {dp, dn}, given the inverse dinv of two most
+   significant limbs of the divisor, i.e. floor((B^3 - 1)/{dp + dn - 2, 2}) - B.
+   Requires dn > 2, nn >= dn and normalized divisor (the highest bit is set).
+   Writes nn - dn limbs of the quotient to qp and returns its high limb; the
+   remainder is left in the low dn limbs of np.  The schoolbook variant doesn't
+   allocate memory, the divide-and-conquer one requires dn >= 6 and
+   nn - dn >= 3. */
+mp_limb_t mpn_sbpi1_div_qr(mp_limb_t *qp, mp_limb_t *np, mp_size_t nn,
+                           const mp_limb_t *dp, mp_size_t dn, mp_limb_t dinv);
+mp_limb_t mpn_dcpi1_div_qr(mp_limb_t *qp, mp_limb_t *np, mp_size_t nn,
+                           const mp_limb_t *dp, mp_size_t dn, mp_limb_t dinv);
+
+/* Montgomery reduction: set {rp, n} to {up, 2n}/B^n mod {mp, n} (up to the
+   returned carry, i.e. {rp, n} + carry*B^n is the result, that is less than
+   B^n + mp).  Requires odd mp and invm = -1/mp mod B.  Destroys {up, 2n}. */
+mp_limb_t mpn_redc_1(mp_limb_t *rp, mp_limb_t *up, const mp_limb_t *mp,
+                     mp_size_t n, mp_limb_t invm);
+
 /* Return the value {up,size}*2^exp, and negative if sign<0.  Must have
    a non-zero high limb up[size-1]. */
 double mpn_get_d(const mp_limb_t *up, mp_size_t size, mp_size_t sign, long exp);
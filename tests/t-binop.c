@@ -194,6 +194,9 @@ ZZ_BINOP_REF(mul)
 ZZ_BINOP_REF(fdiv_q)
 ZZ_BINOP_REF(fdiv_r)
 
+#define zz_ref_quo zz_ref_fdiv_q
+#define zz_ref_mod zz_ref_fdiv_r
+
 ZZ_BINOP_REF(and)
 #define zz_ior zz_or
 ZZ_BINOP_REF(ior)
@@ -248,8 +251,16 @@ TEST_MIXBINOP(add, 512, true)
 TEST_MIXBINOP(sub, 512, true)
 TEST_MIXBINOP(mul, 512, true)
 
+/* Exercise also mpn_mul(), beyond the schoolbook range of zz_mul() */
+#define zz_mul_large zz_mul
+#define zz_ref_mul_large zz_ref_mul
+
+TEST_BINOP(mul_large, 4096, true)
+
 TEST_MIXBINOP(fdiv_q, 512, true)
 TEST_MIXBINOP(fdiv_r, 512, true)
+TEST_BINOP(quo, 512, true)
+TEST_BINOP(mod, 512, true)
 
 TEST_BINOP(and, 512, true)
 TEST_BINOP(ior, 512, true)
@@ -400,6 +411,17 @@ check_binop_examples(void)
     if (zz_set(123, &u) || zz_sub(&u, 123U, &u) || zz_cmp(&u, 0) != ZZ_EQ) {
         abort();
     }
+    if (zz_set(0, &v) || zz_quo(&u, &v, &u) != ZZ_VAL
+        || zz_mod(&u, &v, &u) != ZZ_VAL)
+    {
+        abort();
+    }
+    if (zz_set(-3, &u) || zz_mul_2exp(&u, 200, &u) || zz_pos(&u, &v)
+        || zz_quo(&u, &u, &u) || zz_cmp(&u, 1) != ZZ_EQ
+        || zz_mod(&v, &v, &v) || zz_cmp(&v, 0) != ZZ_EQ)
+    {
+        abort();
+    }
     zz_clear(&u);
     zz_clear(&v);
 }
@@ -617,6 +639,275 @@ check_square_outofmem_pthread(void)
 }
 #endif /* HAVE_PTHREAD_H */
 
+void
+check_addmul_bulk(void)
+{
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_bitcnt_t bs = i%4 ? 512 : 4096;
+        zz_t u, v, w, acc, r;
+
+        if (zz_init(&u) || zz_init(&v) || zz_init(&w) || zz_init(&acc)
+            || zz_init(&r) || zz_random(bs, true, &u)
+            || zz_random(i%3 ? bs : 64, true, &v)
+            || zz_random(i%5 ? 2*bs : 64, true, &w))
+        {
+            abort();
+        }
+        if (zz_mul(&u, &v, &r) || zz_add(&w, &r, &r) || zz_pos(&w, &acc)
+            || zz_addmul(&u, &v, &acc) || zz_cmp(&acc, &r) != ZZ_EQ)
+        {
+            abort();
+        }
+        if (zz_mul(&u, &v, &r) || zz_sub(&w, &r, &r) || zz_pos(&w, &acc)
+            || zz_submul(&u, &v, &acc) || zz_cmp(&acc, &r) != ZZ_EQ)
+        {
+            abort();
+        }
+        /* aliasing of the accumulator */
+        if (zz_mul(&u, &v, &r) || zz_add(&u, &r, &r) || zz_pos(&u, &acc)
+            || zz_addmul(&acc, &v, &acc) || zz_cmp(&acc, &r) != ZZ_EQ
+            || zz_mul(&u, &u, &r) || zz_sub(&u, &r, &r) || zz_pos(&u, &acc)
+            || zz_submul(&acc, &acc, &acc) || zz_cmp(&acc, &r) != ZZ_EQ)
+        {
+            abort();
+        }
+
+        int64_t val;
+        uint64_t uval;
+
+        if (zz_get(&v, &val) == ZZ_OK) {
+            if (zz_mul(&u, &v, &r) || zz_add(&w, &r, &r)
+                || zz_pos(&w, &acc) || zz_addmul(&u, val, &acc)
+                || zz_cmp(&acc, &r) != ZZ_EQ
+                || zz_mul(&u, &v, &r) || zz_sub(&w, &r, &r)
+                || zz_pos(&w, &acc) || zz_submul(&u, val, &acc)
+                || zz_cmp(&acc, &r) != ZZ_EQ
+                || zz_mul(&u, &v, &r) || zz_add(&u, &r, &r)
+                || zz_pos(&u, &acc) || zz_addmul(&acc, val, &acc)
+                || zz_cmp(&acc, &r) != ZZ_EQ)
+            {
+                abort();
+            }
+        }
+        if (zz_abs(&v, &v) || zz_get(&v, &uval) == ZZ_OK) {
+            if (zz_mul(&u, &v, &r) || zz_add(&w, &r, &r)
+                || zz_pos(&w, &acc) || zz_addmul(&u, uval, &acc)
+                || zz_cmp(&acc, &r) != ZZ_EQ
+                || zz_mul(&u, &v, &r) || zz_sub(&w, &r, &r)
+                || zz_pos(&w, &acc) || zz_submul(&u, uval, &acc)
+                || zz_cmp(&acc, &r) != ZZ_EQ)
+            {
+                abort();
+            }
+        }
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&w);
+        zz_clear(&acc);
+        zz_clear(&r);
+    }
+}
+
+void
+check_divexact_bulk(void)
+{
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_bitcnt_t bs = i%4 ? 512 : 4096;
+        zz_t u, v, w, q;
+
+        if (zz_init(&u) || zz_init(&v) || zz_init(&w) || zz_init(&q)
+            || zz_random(i%3 ? bs : 64, true, &v)
+            || zz_random(bs, true, &w) || zz_mul(&v, &w, &u))
+        {
+            abort();
+        }
+        if (zz_iszero(&v)) {
+            if (zz_divexact(&u, &v, &q) != ZZ_VAL) {
+                abort();
+            }
+            goto clear;
+        }
+        if (zz_divexact(&u, &v, &q) || zz_cmp(&q, &w) != ZZ_EQ
+            || zz_pos(&u, &q) || zz_divexact(&q, &v, &q)
+            || zz_cmp(&q, &w) != ZZ_EQ
+            || zz_pos(&v, &q) || zz_divexact(&u, &q, &q)
+            || zz_cmp(&q, &w) != ZZ_EQ
+            || zz_divexact(&u, &u, &q)
+            || zz_cmp(&q, !zz_iszero(&u)) != ZZ_EQ)
+        {
+            abort();
+        }
+
+        uint64_t val;
+
+        if (zz_get(&v, &val) == ZZ_OK) {
+            if (zz_divexact_u64(&u, val, &q) || zz_cmp(&q, &w) != ZZ_EQ
+                || zz_pos(&u, &q) || zz_divexact_u64(&q, val, &q)
+                || zz_cmp(&q, &w) != ZZ_EQ)
+            {
+                abort();
+            }
+        }
+clear:
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&w);
+        zz_clear(&q);
+    }
+}
+
+void
+check_divisor_bulk(void)
+{
+    zz_divisor_t d;
+
+    if (zz_divisor_u64(0, &d) != ZZ_VAL) {
+        abort();
+    }
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_bitcnt_t bs = i%4 ? 512 : 4096;
+        zz_t u, v, q1, r1, q2, r2;
+        uint64_t val, rem;
+
+        if (zz_init(&u) || zz_init(&v) || zz_init(&q1) || zz_init(&r1)
+            || zz_init(&q2) || zz_init(&r2)
+            || zz_random(bs, true, &u) || zz_random(64, false, &v)
+            || zz_get(&v, &val))
+        {
+            abort();
+        }
+        switch (i%5) {
+            case 0:
+                val = 1 + val%16;
+                break;
+            case 1:
+                val |= UINT64_C(1) << 63;
+                break;
+            case 2:
+                val = UINT64_C(1) << (val%64);
+                break;
+            default:
+                val += !val;
+        }
+        if (zz_set(val, &v) || zz_divisor_u64(val, &d)
+            || zz_div(&u, &v, &q1, &r1)
+            || zz_div_divisor(&u, &d, &q2, &rem)
+            || zz_cmp(&q1, &q2) != ZZ_EQ || zz_set(rem, &r2)
+            || zz_cmp(&r1, &r2) != ZZ_EQ || zz_mod_divisor(&u, &d) != rem
+            || zz_pos(&u, &q2) || zz_quo_divisor(&q2, &d, &q2)
+            || zz_cmp(&q1, &q2) != ZZ_EQ)
+        {
+            abort();
+        }
+        if (val <= INT64_MAX) {
+            if (zz_pos(&u, &q2) || zz_div_i64(&q2, (int64_t)val, &q2, &r2)
+                || zz_cmp(&q1, &q2) != ZZ_EQ || zz_cmp(&r1, &r2) != ZZ_EQ
+                || zz_div_i64(&u, (int64_t)val, NULL, &r2)
+                || zz_cmp(&r1, &r2) != ZZ_EQ)
+            {
+                abort();
+            }
+        }
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&q1);
+        zz_clear(&r1);
+        zz_clear(&q2);
+        zz_clear(&r2);
+    }
+}
+
+/* Compare inline fast paths for small operands with out-of-line
+   functions. */
+void
+check_small_examples(void)
+{
+    zz_t vals[14], u, v, w1, w2, r1, r2;
+    size_t n = sizeof(vals)/sizeof(vals[0]);
+
+    for (size_t i = 0; i < n; i++) {
+        if (zz_init(&vals[i])) {
+            abort();
+        }
+    }
+    if (zz_set(1, &vals[1]) || zz_set(2, &vals[2]) || zz_set(7, &vals[3])
+        || zz_mul_2exp(&vals[1], 63, &vals[4])
+        || zz_sub(&vals[4], 1, &vals[5]) || zz_add(&vals[4], &vals[5], &vals[5])
+        || zz_mul_2exp(&vals[1], 64, &vals[6])
+        || zz_mul_2exp(&vals[1], 127, &vals[7])
+        || zz_sub(&vals[7], 1, &vals[8]) || zz_add(&vals[7], &vals[8], &vals[8])
+        || zz_mul(&vals[5], &vals[3], &vals[9])
+        || zz_mul_2exp(&vals[1], 128, &vals[10])
+        || zz_mul_2exp(&vals[5], 32, &vals[11])
+        || zz_add(&vals[6], 3, &vals[12]) || zz_neg(&vals[8], &vals[13]))
+    {
+        abort();
+    }
+    if (zz_init(&u) || zz_init(&v) || zz_init(&w1) || zz_init(&w2)
+        || zz_init(&r1) || zz_init(&r2))
+    {
+        abort();
+    }
+    for (size_t i = 0; i < 2*n; i++) {
+        for (size_t j = 0; j < 2*n; j++) {
+            if (zz_pos(&vals[i/2], &u) || zz_pos(&vals[j/2], &v)
+                || (i%2 && zz_neg(&u, &u)) || (j%2 && zz_neg(&v, &v)))
+            {
+                abort();
+            }
+            if (zz_add(&u, &v, &w1) || (zz_add)(&u, &v, &w2)
+                || zz_cmp(&w1, &w2) != ZZ_EQ
+                || zz_sub(&u, &v, &w1) || (zz_sub)(&u, &v, &w2)
+                || zz_cmp(&w1, &w2) != ZZ_EQ
+                || zz_mul(&u, &v, &w1) || (zz_mul)(&u, &v, &w2)
+                || zz_cmp(&w1, &w2) != ZZ_EQ
+                || zz_cmp(&u, &v) != (zz_cmp)(&u, &v)
+                || zz_iszero(&u) != (zz_iszero)(&u)
+                || zz_isneg(&u) != (zz_isneg)(&u)
+                || zz_isodd(&u) != (zz_isodd)(&u))
+            {
+                abort();
+            }
+
+            int64_t x;
+
+            if (zz_get(&v, &x) == ZZ_OK
+                && zz_cmp(&u, x) != (zz_cmp_i64)(&u, x))
+            {
+                abort();
+            }
+            if (zz_iszero(&v)) {
+                continue;
+            }
+            if (zz_div(&u, &v, &w1, &r1) || (zz_div)(&u, &v, &w2, &r2)
+                || zz_cmp(&w1, &w2) != ZZ_EQ || zz_cmp(&r1, &r2) != ZZ_EQ)
+            {
+                abort();
+            }
+            /* aliasing */
+            if (zz_pos(&u, &w1) || zz_add(&w1, &w1, &w1)
+                || zz_add(&u, &u, &w2) || zz_cmp(&w1, &w2) != ZZ_EQ
+                || zz_pos(&v, &w1) || zz_mul(&u, &w1, &w1)
+                || zz_mul(&u, &v, &w2) || zz_cmp(&w1, &w2) != ZZ_EQ
+                || zz_pos(&u, &w1) || zz_pos(&v, &r1)
+                || zz_div(&w1, &r1, &r1, &w1) || zz_div(&u, &v, &w2, &r2)
+                || zz_cmp(&r1, &w2) != ZZ_EQ || zz_cmp(&w1, &r2) != ZZ_EQ)
+            {
+                abort();
+            }
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        zz_clear(&vals[i]);
+    }
+    zz_clear(&u);
+    zz_clear(&v);
+    zz_clear(&w1);
+    zz_clear(&w2);
+    zz_clear(&r1);
+    zz_clear(&r2);
+}
+
 int
 main(void)
 {
@@ -626,14 +917,21 @@ main(void)
     check_add_bulk();
     check_sub_bulk();
     check_mul_bulk();
+    check_mul_large_bulk();
     check_fdiv_q_bulk();
     check_fdiv_r_bulk();
+    check_quo_bulk();
+    check_mod_bulk();
     check_and_bulk();
     check_ior_bulk();
     check_xor_bulk();
     check_gcd_bulk();
     check_lcm_bulk();
     check_binop_examples();
+    check_small_examples();
+    check_addmul_bulk();
+    check_divexact_bulk();
+    check_divisor_bulk();
     check_lshift_bulk();
     check_rshift_bulk();
     check_shift_examples();
@@ -212,6 +212,49 @@ check_sqrtrem_examples(void)
     if (zz_set(-1, &u) || zz_sqrtrem(&u, &v, NULL) != ZZ_VAL) {
         abort();
     }
+
+    const uint64_t x[] = {UINT64_MAX, UINT64_MAX - 1,
+                          0xfffffffe00000001ULL, 0xfffffffe00000000ULL,
+                          0xfffffffe00000002ULL, (1ULL << 52) + 1,
+                          ((1ULL << 53) - 1)*((1ULL << 53) - 1) >> 42,
+                          0x3fffffffffffffffULL, 1ULL << 62};
+
+    for (size_t i = 0; i < sizeof(x)/sizeof(x[0]); i++) {
+        zz_t w;
+        uint64_t s, r;
+
+        if (zz_init(&w) || zz_set(x[i], &u) || zz_sqrtrem(&u, &v, &w)
+            || zz_get(&v, &s) || zz_get(&w, &r))
+        {
+            abort();
+        }
+        if (s > UINT32_MAX || s*s > x[i] || x[i] - s*s != r
+            || (s < UINT32_MAX && (s + 1)*(s + 1) <= x[i]))
+        {
+            abort();
+        }
+        zz_clear(&w);
+    }
+    zz_clear(&u);
+    zz_clear(&v);
+}
+
+void
+check_fac_examples(void)
+{
+    zz_t u, v;
+
+    if (zz_init(&u) || zz_init(&v) || zz_set(1, &v)) {
+        abort();
+    }
+    for (uint64_t x = 0; x < 30; x++) {
+        if (x && zz_mul(&v, (int64_t)x, &v)) {
+            abort();
+        }
+        if (zz_fac(x, &u) || zz_cmp(&u, &v) != ZZ_EQ) {
+            abort();
+        }
+    }
     zz_clear(&u);
     zz_clear(&v);
 }
@@ -550,6 +593,12 @@ check_fromto_double(void)
     if (zz_set(0, &u) || zz_get(&u, &d) || d != 0.0) {
         abort();
     }
+    if (zz_set(1e300, &u) || zz_get(&u, &d) || d != 1e300) {
+        abort();
+    }
+    if (zz_set(-0x1p+200, &u) || zz_bitlen(&u) != 201 || !zz_isneg(&u)) {
+        abort();
+    }
     zz_clear(&u);
 }
 
@@ -866,12 +915,614 @@ check_sizeof(void)
 {
     zz_t u;
 
-    if (zz_init(&u) || zz_set(1, &u)
-        || zz_sizeof(&u) < sizeof(zz_t) + sizeof(zz_digit_t))
+    if (zz_init(&u) || zz_sizeof(&u) != sizeof(zz_t) || zz_set(1, &u)) {
+        abort();
+    }
+#ifdef ZZ_COMPACT_HEADER
+    if (sizeof(zz_t) > 16) {
+        abort();
+    }
+#else
+    if (zz_sizeof(&u) != sizeof(zz_t)) {
+        abort();
+    }
+#endif
+    if (zz_mul_2exp(&u, 64*ZZ_INLINE_DIGITS, &u)
+        || zz_sizeof(&u) < sizeof(zz_t) + (ZZ_INLINE_DIGITS
+                                           + 1)*sizeof(zz_digit_t))
+    {
+        abort();
+    }
+    zz_clear(&u);
+    if (zz_sizeof(&u) != sizeof(zz_t)) {
+        abort();
+    }
+}
+
+void
+check_pool(void)
+{
+    zz_t u, v;
+
+    if (zz_init(&u) || zz_set(1, &u) || zz_mul_2exp(&u, 128, &u)) {
+        abort();
+    }
+
+    zz_digit_t *digits = u.digits;
+
+    zz_clear(&u);
+    if (zz_init(&v) || zz_set(3, &v) || zz_mul_2exp(&v, 130, &v)
+        || v.digits != digits)
+    {
+        abort();
+    }
+    if (zz_init(&u) || zz_pos(&v, &u) || zz_cmp(&u, &v) != ZZ_EQ) {
+        abort();
+    }
+    zz_clear(&u);
+    zz_clear(&v);
+    zz_pool_set_limits(0, 0);
+    if (zz_init(&u) || zz_set(1, &u) || zz_mul_2exp(&u, 128, &u)
+        || zz_add(&u, &u, &u) || zz_bitlen(&u) != 130)
+    {
+        abort();
+    }
+    zz_clear(&u);
+    zz_pool_set_limits(1024, 16);
+    zz_pool_flush();
+}
+
+void
+check_growth(void)
+{
+    zz_t u, v;
+
+    if (zz_init(&u) || zz_init(&v) || zz_set(1, &v)
+        || zz_mul_2exp(&v, 64*2000, &v))
+    {
+        abort();
+    }
+    zz_set_growth(&u, ZZ_GROWTH_EXACT);
+    /* Sizes, that are served by the pool, aren't rounded */
+    if (zz_set(1, &u) || zz_mul_2exp(&u, 64*4, &u) || GETALLOC(&u) != 5) {
+        abort();
+    }
+    if (zz_pos(&v, &u) || GETALLOC(&u) != 2001) {
+        abort();
+    }
+    if (zz_mul_2exp(&u, 64, &u) || GETALLOC(&u) != 2002) {
+        abort();
+    }
+    zz_set_growth(&u, ZZ_GROWTH_GEOMETRIC);
+    if (zz_mul_2exp(&u, 64, &u) || GETALLOC(&u) != 3003 || u.size != 2003) {
+        abort();
+    }
+
+    int reallocs = 0;
+
+    zz_set_growth(&u, ZZ_GROWTH_DEFAULT);
+    for (int i = 0; i < 10000; i++) {
+        zz_size_t alloc = GETALLOC(&u);
+
+        if (zz_mul_2exp(&u, 64, &u)) {
+            abort();
+        }
+        reallocs += alloc != GETALLOC(&u);
+    }
+    if (reallocs > 10 || u.size != 12003) {
+        abort();
+    }
+    zz_set_default_growth(ZZ_GROWTH_EXACT);
+    zz_clear(&u);
+    if (zz_init(&u) || zz_pos(&v, &u) || GETALLOC(&u) != 2001) {
+        abort();
+    }
+    zz_set_default_growth(ZZ_GROWTH_DEFAULT);
+    zz_clear(&u);
+    zz_clear(&v);
+}
+
+void
+check_arena(void)
+{
+    zz_arena_t arena;
+    zz_t u, v, w, r;
+
+    if (zz_arena_init(&arena, 128) || zz_init_arena(&u, &arena)
+        || zz_init_arena(&v, &arena) || zz_init(&r))
+    {
+        abort();
+    }
+    for (int i = 0; i < 3; i++) {
+        if (zz_set(-7, &u) || zz_set(1, &v) || zz_set(-7, &r)) {
+            abort();
+        }
+
+        zz_digit_t *digits = v.digits;
+
+        /* v is the last allocation, so it's extended in place */
+        if (zz_mul_2exp(&v, 64*100, &v) || zz_sub(&v, 1, &v)
+            || v.digits != digits)
+        {
+            abort();
+        }
+        for (int j = 0; j < 50; j++) {
+            if (zz_mul(&u, -7, &u) || zz_mul(&r, -7, &r)) {
+                abort();
+            }
+            if (j == 10 && zz_init_arena(&w, &arena)) {
+                abort();
+            }
+        }
+        if (zz_add(&u, &v, &w) || zz_add(&r, &v, &r)
+            || zz_cmp(&w, &r) != ZZ_EQ || zz_bitlen(&v) != 64*100)
+        {
+            abort();
+        }
+        zz_arena_reset(&arena);
+        if (zz_init_arena(&u, &arena) || zz_init_arena(&v, &arena)) {
+            abort();
+        }
+    }
+    zz_clear(&u);
+    if (zz_set(1, &u) || zz_mul_2exp(&u, 1000, &u)
+        || zz_sizeof(&u) <= sizeof(zz_t))
+    {
+        abort();
+    }
+    zz_clear(&u);
+    zz_clear(&r);
+    zz_arena_clear(&arena);
+}
+
+void
+check_capacity(void)
+{
+    zz_t u, v;
+
+    if (zz_init(&u) || zz_init(&v) || zz_reserve(&u, 5000) || GETALLOC(&u) < 5000
+        || u.size || zz_reserve(&u, -1) != ZZ_VAL
+        || zz_reserve(&u, ZZ_DIGITS_MAX + (zz_size_t)1) != ZZ_BUF)
+    {
+        abort();
+    }
+
+    zz_digit_t *digits = u.digits;
+
+    if (zz_set(1, &u) || zz_mul_2exp(&u, 64*4000, &u) || u.digits != digits
+        || zz_reserve(&u, 100) || u.digits != digits
+        || zz_shrink_to_fit(&u) || GETALLOC(&u) != 4001
+        || zz_bitlen(&u) != 64*4000 + 1)
+    {
+        abort();
+    }
+    if (zz_quo_2exp(&u, 64*4000 - 1, &u) || zz_shrink_to_fit(&u)
+        || GETALLOC(&u) > MAX(4, ZZ_INLINE_DIGITS)
+        || ISINLINE(&u) != (ZZ_INLINE_DIGITS > 0)
+        || zz_cmp(&u, 2) != ZZ_EQ)
+    {
+        abort();
+    }
+    /* trimming on assignment */
+    if (zz_set(1, &v) || zz_mul_2exp(&v, 64*4000, &v) || zz_pos(&v, &u)
+        || zz_set(123, &u) || GETALLOC(&u) < 4001)
+    {
+        abort();
+    }
+    zz_set_trim_ratio(4);
+    if (zz_pos(&v, &u) || zz_set(123, &u)
+        || GETALLOC(&u) > MAX(4, ZZ_INLINE_DIGITS)
+        || ISINLINE(&u) != (ZZ_INLINE_DIGITS > 0)
+        || zz_cmp(&u, 123) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_pos(&v, &u) || zz_quo_2exp(&v, 64*2000, &v) || zz_pos(&v, &u)
+        || GETALLOC(&u) < 4001 || zz_quo_2exp(&v, 64*1500, &v) || zz_pos(&v, &u)
+        || GETALLOC(&u) >= 4001 || zz_cmp(&u, &v) != ZZ_EQ)
+    {
+        abort();
+    }
+    /* Capacity, rounded up by the pool, must pass the ratio test, so u
+       isn't trimmed again on next assignments. */
+    zz_set_trim_ratio(2);
+    if (zz_set(1, &v) || zz_mul_2exp(&v, 64*4000, &v) || zz_pos(&v, &u)
+        || zz_set(1, &v) || zz_mul_2exp(&v, 64*85, &v) || zz_pos(&v, &u)
+        || GETALLOC(&u)/2 > u.size)
+    {
+        abort();
+    }
+    digits = u.digits;
+    for (int i = 0; i < 10; i++) {
+        if (zz_pos(&v, &u) || u.digits != digits) {
+            abort();
+        }
+    }
+    zz_set_trim_ratio(0);
+    /* Pooled capacity can't be reduced to the size */
+    if (zz_set(1, &u) || zz_mul_2exp(&u, 64*4, &u) || zz_shrink_to_fit(&u)) {
+        abort();
+    }
+    digits = u.digits;
+    if (zz_shrink_to_fit(&u) || u.digits != digits
+        || zz_shrink_to_fit(&u) || u.digits != digits)
     {
         abort();
     }
     zz_clear(&u);
+    zz_clear(&v);
+}
+
+void
+check_mmap(void)
+{
+    zz_t u, v;
+
+    if (zz_init(&u) || zz_init(&v) || zz_set(3, &v)
+        || zz_mul_2exp(&v, 64*200000, &v))
+    {
+        abort();
+    }
+    zz_set_mmap_threshold(1000*1000);
+    if (zz_set(3, &u) || zz_mul_2exp(&u, 64*200000, &u)
+        || zz_cmp(&u, &v) != ZZ_EQ || GETALLOC(&u) % 512)
+    {
+        abort();
+    }
+    if (zz_mul(&u, &u, &u) || zz_mul(&v, &v, &v) || zz_cmp(&u, &v) != ZZ_EQ
+        || GETALLOC(&u) % 512 || zz_add(&u, 1, &u) || zz_add(&v, 1, &v)
+        || zz_cmp(&u, &v) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_quo_2exp(&u, 64*200000, &u) || zz_quo_2exp(&v, 64*200000, &v)
+        || zz_shrink_to_fit(&u) || GETALLOC(&u) % 512 || GETALLOC(&u) > 200704
+        || zz_cmp(&u, &v) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_quo_2exp(&u, 64*200000, &u) || zz_quo_2exp(&v, 64*200000, &v)
+        || zz_shrink_to_fit(&u) || GETALLOC(&u) > MAX(4, ZZ_INLINE_DIGITS)
+        || ISINLINE(&u) != (ZZ_INLINE_DIGITS > 0)
+        || zz_cmp(&u, &v) != ZZ_EQ || zz_cmp(&u, 9) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_mul_2exp(&u, 64*200000, &u) || zz_quo_2exp(&u, 64*100000, &u)
+        || zz_shrink_to_fit(&u) || GETALLOC(&u) != 100001
+        || zz_mul_2exp(&v, 64*100000, &v) || zz_cmp(&u, &v) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_mul_2exp(&u, 64*200000, &u)) {
+        abort();
+    }
+    zz_clear(&u);
+    zz_clear(&v);
+    zz_set_mmap_threshold(0);
+}
+
+/* The copy-on-write mode can be changed only outside of zz_setup() and
+   zz_finish(). */
+void
+set_copy_on_write(bool enable)
+{
+    zz_finish();
+#ifndef __STDC_NO_ATOMICS__
+    if (zz_set_copy_on_write(enable)) {
+        abort();
+    }
+#else
+    if (zz_set_copy_on_write(enable) != (enable ? ZZ_VAL : ZZ_OK)) {
+        abort();
+    }
+#endif
+    if (zz_setup()) {
+        abort();
+    }
+}
+
+void
+check_cow(void)
+{
+    zz_t u, v, w, r;
+
+    set_copy_on_write(true);
+    if (zz_init(&u) || zz_init(&v) || zz_init(&w) || zz_init(&r)
+        || zz_set(-3, &u) || zz_mul_2exp(&u, 64*20, &u)
+        || zz_add(&u, 7, &u) || zz_pos(&u, &v) || zz_cmp(&u, &v) != ZZ_EQ)
+    {
+        abort();
+    }
+#ifndef __STDC_NO_ATOMICS__
+    if (u.digits != v.digits) {
+        abort();
+    }
+#endif
+    /* the mode can't be changed after zz_setup() */
+    if (zz_set_copy_on_write(false) != ZZ_VAL
+        || zz_set_copy_on_write(true) != ZZ_VAL || zz_pos(&u, &w)
+        || zz_cmp(&u, &w) != ZZ_EQ)
+    {
+        abort();
+    }
+#ifndef __STDC_NO_ATOMICS__
+    if (u.digits != w.digits) {
+        abort();
+    }
+#endif
+    /* changes of one copy are not visible in another */
+    if (zz_add(&v, 1, &v) || zz_sub(&v, &u, &w) || zz_cmp(&w, 1) != ZZ_EQ
+        || u.digits == v.digits || zz_pos(&u, &v) || zz_neg(&v, &v)
+        || zz_add(&u, &v, &w) || zz_cmp(&w, 0) != ZZ_EQ || !zz_isneg(&u))
+    {
+        abort();
+    }
+    /* aliasing of arguments */
+    if (zz_pos(&u, &v) || zz_mul(&v, &v, &v) || zz_mul(&u, &u, &w)
+        || zz_cmp(&v, &w) != ZZ_EQ || zz_pos(&u, &v)
+        || zz_mul(&u, &v, &v) || zz_cmp(&v, &w) != ZZ_EQ
+        || zz_pos(&u, &v) || zz_pow(&v, 3, &v) || zz_pow(&u, 3, &w)
+        || zz_cmp(&v, &w) != ZZ_EQ || zz_pos(&w, &v)
+        || zz_div(&v, &u, &v, &r) || zz_cmp(&r, 0) != ZZ_EQ
+        || zz_mul(&u, &u, &w) || zz_cmp(&v, &w) != ZZ_EQ
+        || zz_pos(&u, &v) || zz_div(&v, &v, &r, &v)
+        || zz_cmp(&r, 1) != ZZ_EQ || zz_cmp(&v, 0) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_abs(&u, &w) || zz_pos(&w, &v) || zz_sqrtrem(&v, &v, &r)
+        || zz_mul(&v, &v, &v) || zz_add(&v, &r, &v)
+        || zz_cmp(&v, &w) != ZZ_EQ
+        || zz_sub(&w, 2, &r) || zz_pos(&u, &v)
+        || zz_powm(&v, &v, &r, &v) || zz_powm(&u, &u, &r, &w)
+        || zz_cmp(&v, &w) != ZZ_EQ)
+    {
+        abort();
+    }
+    /* mpn_gcd() and mpn_gcdext() destroy inputs */
+    if (zz_mul(&u, 5, &v) || zz_pos(&u, &w)
+        || zz_gcdext(&v, &w, &r, NULL, NULL)
+        || zz_cmp(&w, &u) != ZZ_EQ || zz_abs(&u, &w)
+        || zz_cmp(&r, &w) != ZZ_EQ
+        || zz_gcdext(&v, &u, &r, &w, NULL) || zz_abs(&u, &w)
+        || zz_cmp(&r, &w) != ZZ_EQ || zz_div(&v, &u, &r, NULL)
+        || zz_cmp(&r, 5) != ZZ_EQ)
+    {
+        abort();
+    }
+    if (zz_pos(&u, &v) || zz_shrink_to_fit(&v) || zz_cmp(&u, &v) != ZZ_EQ)
+    {
+        abort();
+    }
+    zz_clear(&u);
+    if (zz_cmp(&v, 0) != ZZ_GT && zz_cmp(&v, 0) != ZZ_LT) {
+        abort();
+    }
+    zz_clear(&v);
+    zz_clear(&w);
+    zz_clear(&r);
+    set_copy_on_write(false);
+}
+
+void
+check_small(void)
+{
+    static const zz_digit_t d[] = {0, 0, 0, 0, 0, 0, 0, 1};
+    static const zz_t big = ZZ_CONST_INIT(true, 8, d);
+    zz_t u;
+
+    if (zz_small(ZZ_SMALL_MIN - 1) || zz_small(ZZ_SMALL_MAX + 1)
+        || zz_init(&u))
+    {
+        abort();
+    }
+    for (int64_t v = ZZ_SMALL_MIN; v <= ZZ_SMALL_MAX; v++) {
+        const zz_t *c = zz_small(v);
+
+        if (!c || zz_cmp(c, v) != ZZ_EQ || zz_add(c, zz_small(1), &u)
+            || zz_cmp(&u, v + 1) != ZZ_EQ || zz_mul(c, c, &u)
+            || zz_cmp(&u, v*v) != ZZ_EQ)
+        {
+            abort();
+        }
+    }
+    zz_clear(&u);
+    for (int enable = 0; enable < 2; enable++) {
+        set_copy_on_write(enable);
+        if (zz_set(-1, &u) || zz_mul_2exp(&u, 7*64, &u)
+            || zz_cmp(&big, &u) != ZZ_EQ || zz_pos(&big, &u)
+            || u.digits == big.digits || zz_add(&u, 1, &u)
+            || zz_cmp(&big, &u) != ZZ_LT)
+        {
+            abort();
+        }
+        zz_clear(&u);
+        set_copy_on_write(false);
+    }
+}
+
+void
+check_budget(void)
+{
+    zz_t u, v;
+
+    if (zz_init(&u) || zz_init(&v) || zz_set(3, &u)) {
+        abort();
+    }
+    zz_set_memory_budget(1000*1000);
+    if (zz_mul_2exp(&u, 64*200000, &u) != ZZ_LIM
+        || zz_pow(&u, 10*1000*1000, &u) != ZZ_LIM
+        || zz_fac(1000*1000, &u) != ZZ_LIM
+        || zz_bin(10*1000*1000, 5*1000*1000, &u) != ZZ_LIM
+        || zz_cmp(&u, 3) != ZZ_EQ)
+    {
+        abort();
+    }
+    /* outputs are kept, even if shared */
+    zz_clear(&u);
+    set_copy_on_write(true);
+    if (zz_set(3, &u) || zz_mul_2exp(&u, 64*15000, &u) || zz_mul(&u, &u, &u)
+        || zz_pos(&u, &v) || zz_mul(&u, &u, &u) != ZZ_LIM
+        || zz_pow(&u, 3, &u) != ZZ_LIM || zz_cmp(&u, &v) != ZZ_EQ
+        || zz_fac(10000, &u) || zz_bin(10000, 5000, &u))
+    {
+        abort();
+    }
+    zz_clear(&u);
+    zz_clear(&v);
+    set_copy_on_write(false);
+    zz_set_memory_budget(0);
+    if (zz_set(3, &u) || zz_mul_2exp(&u, 64*200000, &u)
+        || zz_quo_2exp(&u, 64*200000, &u) || zz_cmp(&u, 3) != ZZ_EQ)
+    {
+        abort();
+    }
+    zz_clear(&u);
+}
+
+void
+check_stats(void)
+{
+    zz_stats_t st, total;
+    zz_t u, v;
+
+    zz_stats_reset();
+    zz_stats_enable(true);
+    if (zz_init(&u) || zz_init(&v) || zz_set(1, &u)
+        || zz_mul_2exp(&u, 64*100, &u) || zz_mul(&u, &u, &v)
+        || zz_add(&u, &v, &u))
+    {
+        abort();
+    }
+    zz_stats_get(&st);
+#if defined(__GNUC__)
+    if (st.ops[ZZ_STATS_MUL].allocs != (ZZ_INLINE_DIGITS ? 2 : 1)
+        || st.ops[ZZ_STATS_ADD].reallocs != 1
+        || st.ops[ZZ_STATS_SET].allocs != (ZZ_INLINE_DIGITS ? 0 : 1)
+        || st.ops[ZZ_STATS_OTHER].allocs)
+    {
+        abort();
+    }
+#endif
+    if (st.live_bytes != (int64_t)zz_sizeof(&u) + (int64_t)zz_sizeof(&v)
+                         - 2*(int64_t)sizeof(zz_t)
+        || st.peak_bytes < st.live_bytes)
+    {
+        abort();
+    }
+    zz_clear(&u);
+    zz_clear(&v);
+    zz_stats_get(&st);
+    zz_stats_enable(false);
+    if (st.live_bytes || st.peak_bytes < 8*300) {
+        abort();
+    }
+    memset(&total, 0, sizeof(zz_stats_t));
+    zz_stats_merge(&total, &st);
+    zz_stats_merge(&total, &st);
+    if (total.peak_bytes != 2*st.peak_bytes
+        || total.ops[ZZ_STATS_OTHER].frees + total.ops[ZZ_STATS_MUL].frees != 4)
+    {
+        abort();
+    }
+    zz_stats_reset();
+}
+
+void
+check_memory_funcs(void)
+{
+    zz_arena_t arena;
+    zz_t u, v;
+
+    zz_set_memory_funcs(my_malloc, my_realloc, my_free);
+    max_size = 16*1000*1000;
+    if (total_size) {
+        abort();
+    }
+    if (zz_init(&u) || zz_set(1, &u) || zz_mul_2exp(&u, 64*100, &u)
+        || total_size < 8*100)
+    {
+        abort();
+    }
+    for (int i = 0; i < 10; i++) {
+        if (zz_mul_2exp(&u, 64*1000, &u)) {
+            abort();
+        }
+    }
+    if (zz_shrink_to_fit(&u) || zz_arena_init(&arena, 0)
+        || zz_init_arena(&v, &arena) || zz_pos(&u, &v)
+        || total_size < 2*8*10000)
+    {
+        abort();
+    }
+    zz_clear(&u);
+    zz_arena_clear(&arena);
+    zz_set_memory_funcs(NULL, NULL, NULL);
+    if (total_size) {
+        abort();
+    }
+}
+
+void
+check_scratch(void)
+{
+    mpz_t a, b;
+
+    if (zz_get_alloc_state()) {
+        abort();
+    }
+    /* non-LIFO usage of temporary allocations */
+    mpz_init_set_ui(a, 1);
+    mpz_init_set_ui(b, 1);
+    mpz_mul_2exp(a, a, 10000);
+    mpz_mul_2exp(b, b, 20000);
+    mpz_mul_2exp(a, a, 10000000);
+    if (zz_get_alloc_state() < 10020000/8) {
+        abort();
+    }
+    mpz_clear(a);
+    mpz_mul_2exp(b, b, 20000);
+    if (mpz_sizeinbase(b, 2) != 40001) {
+        abort();
+    }
+    mpz_clear(b);
+    if (zz_get_alloc_state()) {
+        abort();
+    }
+
+    zz_t u, v;
+
+    if (zz_init(&u) || zz_init(&v) || zz_set(3, &u)
+        || zz_pow(&u, 1000000, &u) || zz_mul(&u, &u, &v)
+        || zz_div(&v, &u, &v, NULL) || zz_cmp(&u, &v) != ZZ_EQ
+        || zz_get_alloc_state())
+    {
+        abort();
+    }
+
+    zz_t w;
+    size_t len;
+
+    if (zz_init(&w) || zz_set(3, &u) || zz_pow(&u, 10000, &u)
+        || zz_sub(&u, 1, &v) || zz_gcdext(&u, &v, &w, NULL, NULL)
+        || zz_gcdext(&u, &v, NULL, &w, NULL) || zz_powm(&u, &v, &v, &w)
+        || zz_sizeinbase(&u, 10, &len))
+    {
+        abort();
+    }
+
+    char *buf = malloc(len + 2);
+
+    if (!buf || zz_get_str(&u, 10, buf) || zz_set_str(buf, 10, &w)
+        || zz_cmp(&u, &w) != ZZ_EQ || zz_get_alloc_state())
+    {
+        abort();
+    }
+    free(buf);
+    zz_clear(&w);
+    zz_clear(&u);
+    zz_clear(&v);
 }
 
 int main(void)
@@ -892,6 +1543,7 @@ int main(void)
     check_bitcnt_examples();
     check_sqrtrem_bulk();
     check_sqrtrem_examples();
+    check_fac_examples();
     check_bin();
     check_isodd_bulk();
     check_isneg();
@@ -905,6 +1557,17 @@ int main(void)
     check_exportimport_roundtrip();
     check_exportimport_examples();
     check_sizeof();
+    check_pool();
+    check_growth();
+    check_arena();
+    check_capacity();
+    check_mmap();
+    check_cow();
+    check_small();
+    check_budget();
+    check_stats();
+    check_memory_funcs();
+    check_scratch();
 #ifdef HAVE_SYS_RESOURCE_H
     struct rlimit new, old;
 
@@ -149,6 +149,106 @@ clear:
     }
 }
 
+/* Moduli of one or two digits */
+void
+check_powm_small_bulk(void)
+{
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_bitcnt_t bs = 1 + (zz_bitcnt_t)(rand()%128);
+        zz_t u, v, w, z, r;
+
+        if (zz_init(&u) || zz_init(&v) || zz_init(&w) || zz_init(&z)
+            || zz_init(&r) || zz_random(i%3 ? bs : 300, true, &u)
+            || zz_random((zz_bitcnt_t)(rand()%200), false, &v)
+            || zz_random(bs, true, &w))
+        {
+            abort();
+        }
+        if (i%7 == 0 && (zz_set(1, &w) || (i%2 && zz_set(-1, &w)))) {
+            abort();
+        }
+        if (i%11 == 0 && (zz_set(1, &w) || zz_mul_2exp(&w, bs - 1, &w))) {
+            abort();
+        }
+        if (zz_iszero(&w)) {
+            goto clear;
+        }
+        if (zz_powm(&u, &v, &w, &z) || zz_ref_powm(&u, &v, &w, &r)
+            || zz_cmp(&z, &r) != ZZ_EQ
+            || zz_pos(&w, &z) || zz_powm(&u, &v, &z, &z)
+            || zz_cmp(&z, &r) != ZZ_EQ
+            || zz_pos(&u, &z) || zz_powm(&z, &v, &w, &z)
+            || zz_cmp(&z, &r) != ZZ_EQ)
+        {
+            abort();
+        }
+clear:
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&w);
+        zz_clear(&z);
+        zz_clear(&r);
+    }
+}
+
+void
+check_powm_2exp_bulk(void)
+{
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_bitcnt_t k = (zz_bitcnt_t)(rand()%300);
+        zz_t u, v, m, x, y, z;
+
+        if (zz_init(&u) || zz_init(&v) || zz_init(&m) || zz_init(&x)
+            || zz_init(&y) || zz_init(&z) || zz_random(300, true, &u)
+            || zz_random((zz_bitcnt_t)(rand()%400), true, &v)
+            || zz_set(1, &m) || zz_mul_2exp(&m, k, &m))
+        {
+            abort();
+        }
+
+        zz_err ret = zz_powm_2exp(&u, &v, k, &x);
+
+        if (!k) {
+            if (ret || zz_cmp(&x, 0) != ZZ_EQ
+                || zz_invert_2exp(&u, k, &x) || zz_cmp(&x, 0) != ZZ_EQ)
+            {
+                abort();
+            }
+            goto clear;
+        }
+        if (ret != zz_powm(&u, &v, &m, &y)) {
+            abort();
+        }
+        if (ret == ZZ_OK
+            && (zz_cmp(&x, &y) != ZZ_EQ
+                || zz_pos(&u, &z) || zz_powm_2exp(&z, &v, k, &z)
+                || zz_cmp(&z, &y) != ZZ_EQ
+                || zz_pos(&v, &z) || zz_powm_2exp(&u, &z, k, &z)
+                || zz_cmp(&z, &y) != ZZ_EQ))
+        {
+            abort();
+        }
+        if (zz_set(-1, &v)) {
+            abort();
+        }
+        ret = zz_invert_2exp(&u, k, &x);
+        if (ret != zz_powm(&u, &v, &m, &y)
+            || (ret == ZZ_OK && zz_cmp(&x, &y) != ZZ_EQ)
+            || (ret == ZZ_OK && (zz_invert_2exp(&u, k, &u)
+                                 || zz_cmp(&u, &y) != ZZ_EQ)))
+        {
+            abort();
+        }
+clear:
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&m);
+        zz_clear(&x);
+        zz_clear(&y);
+        zz_clear(&z);
+    }
+}
+
 void
 check_powm_examples(void)
 {
@@ -209,6 +309,196 @@ check_powm_examples(void)
     zz_clear(&w);
 }
 
+void
+check_mod_ctx_bulk(void)
+{
+    zz_mod_ctx_t ctx;
+    zz_t m;
+
+    if (zz_init(&m) || zz_mod_ctx_init(&ctx, &m) != ZZ_VAL
+        || zz_set(-7, &m) || zz_mod_ctx_init(&ctx, &m) != ZZ_VAL)
+    {
+        abort();
+    }
+    zz_clear(&m);
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_bitcnt_t bs = (i%4 == 3 ? 4000 : 64*(i%7) + 40);
+        zz_t u, v, x, y, z;
+
+        if (zz_init(&m) || zz_init(&u) || zz_init(&v) || zz_init(&x)
+            || zz_init(&y) || zz_init(&z) || zz_random(bs, false, &m)
+            || zz_add(&m, 1, &m) || zz_random(i%3 ? bs : 2*bs, true, &u)
+            || zz_random(bs, true, &v) || zz_mod_ctx_init(&ctx, &m))
+        {
+            abort();
+        }
+        /* Reduction of arbitrary inputs */
+        if (zz_mod_reduce(&u, &ctx, &x) || zz_mod(&u, &m, &y)
+            || zz_cmp(&x, &y) != ZZ_EQ
+            || zz_pos(&u, &x) || zz_mod_reduce(&x, &ctx, &x)
+            || zz_cmp(&x, &y) != ZZ_EQ)
+        {
+            abort();
+        }
+        /* Arithmetic, both on arbitrary and on reduced inputs */
+        for (int k = 0; k < 2; k++) {
+            if (zz_mod_add(&u, &v, &ctx, &x) || zz_add(&u, &v, &y)
+                || zz_mod(&y, &m, &y) || zz_cmp(&x, &y) != ZZ_EQ
+                || zz_mod_sub(&u, &v, &ctx, &x) || zz_sub(&u, &v, &y)
+                || zz_mod(&y, &m, &y) || zz_cmp(&x, &y) != ZZ_EQ
+                || zz_mod_mul(&u, &v, &ctx, &x) || zz_mul(&u, &v, &y)
+                || zz_mod(&y, &m, &y) || zz_cmp(&x, &y) != ZZ_EQ
+                || zz_pos(&u, &x) || zz_mod_mul(&x, &v, &ctx, &x)
+                || zz_cmp(&x, &y) != ZZ_EQ
+                || zz_mod_sqr(&u, &ctx, &x) || zz_mul(&u, &u, &y)
+                || zz_mod(&y, &m, &y) || zz_cmp(&x, &y) != ZZ_EQ
+                || zz_mod_reduce(&u, &ctx, &u)
+                || zz_mod_reduce(&v, &ctx, &v))
+            {
+                abort();
+            }
+        }
+        if (zz_random(128, true, &z)) {
+            abort();
+        }
+
+        zz_err ret = zz_mod_pow(&u, &z, &ctx, &x);
+
+        if (ret == ZZ_OK) {
+            if (zz_ref_powm(&u, &z, &m, &y) || zz_cmp(&x, &y) != ZZ_EQ
+                || zz_pos(&u, &x) || zz_mod_pow(&x, &z, &ctx, &x)
+                || zz_cmp(&x, &y) != ZZ_EQ)
+            {
+                abort();
+            }
+        }
+        else if (ret != ZZ_VAL || zz_ref_gcd(&u, &m, &y)
+                 || zz_cmp(&y, 1) == ZZ_EQ)
+        {
+            abort();
+        }
+        zz_mod_ctx_clear(&ctx);
+        zz_clear(&m);
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&x);
+        zz_clear(&y);
+        zz_clear(&z);
+    }
+}
+
+void
+check_mod_pow_multi_bulk(void)
+{
+    for (size_t i = 0; i < nsamples; i++) {
+        zz_bitcnt_t bs = i%16 == 15 ? 4200 : i%2 ? 512 : 64*(i%5) + 40;
+        size_t n = i%5;
+        zz_mod_ctx_t ctx;
+        zz_t m, x, y, z, us[4], vs[4];
+        const zz_t *u[4], *v[4];
+
+        if (zz_init(&m) || zz_init(&x) || zz_init(&y) || zz_init(&z)
+            || zz_random(bs, false, &m) || zz_add(&m, 1, &m)
+            || zz_mod_ctx_init(&ctx, &m) || zz_set(1, &y)
+            || zz_mod_reduce(&y, &ctx, &y))
+        {
+            abort();
+        }
+        for (size_t j = 0; j < n; j++) {
+            if (zz_init(&us[j]) || zz_init(&vs[j])
+                || zz_random(bs, true, &us[j])
+                || zz_random((zz_bitcnt_t)(rand()%700), j == 2, &vs[j]))
+            {
+                abort();
+            }
+            u[j] = &us[j];
+            v[j] = &vs[j];
+        }
+
+        zz_err ret = zz_mod_pow_multi(u, v, n, &ctx, &x);
+
+        for (size_t j = 0; j < n; j++) {
+            zz_err r = zz_mod_pow(u[j], v[j], &ctx, &z);
+
+            if (r == ZZ_VAL) {
+                if (ret != ZZ_VAL) {
+                    abort();
+                }
+                goto clear;
+            }
+            if (r || zz_mod_mul(&y, &z, &ctx, &y)) {
+                abort();
+            }
+        }
+        if (ret || zz_cmp(&x, &y) != ZZ_EQ) {
+            abort();
+        }
+        if (n && (zz_mod_pow_multi(u, v, n, &ctx, &us[0])
+                  || zz_cmp(&us[0], &y) != ZZ_EQ))
+        {
+            abort();
+        }
+clear:
+        for (size_t j = 0; j < n; j++) {
+            zz_clear(&us[j]);
+            zz_clear(&vs[j]);
+        }
+        zz_mod_ctx_clear(&ctx);
+        zz_clear(&m);
+        zz_clear(&x);
+        zz_clear(&y);
+        zz_clear(&z);
+    }
+}
+
+void
+check_powm_table_bulk(void)
+{
+    for (size_t i = 0; i < nsamples/8; i++) {
+        zz_bitcnt_t bs = i%2 ? 512 : 64*(i%5) + 40;
+        zz_bitcnt_t bits = 1 + (zz_bitcnt_t)(rand()%300);
+        unsigned int window = (unsigned int)(i%9);
+        zz_mod_ctx_t ctx;
+        zz_powm_table_t t;
+        zz_t m, u, v, x, y;
+
+        if (zz_init(&m) || zz_init(&u) || zz_init(&v) || zz_init(&x)
+            || zz_init(&y) || zz_random(bs, false, &m) || zz_add(&m, 1, &m)
+            || zz_random(bs, true, &u) || zz_mod_ctx_init(&ctx, &m)
+            || zz_powm_table_init(&t, &u, &ctx, bits, 17) != ZZ_VAL
+            || zz_powm_table_init(&t, &u, &ctx, bits, window))
+        {
+            abort();
+        }
+        for (int k = 0; k < 8; k++) {
+            /* Exponents might be negative, zero or too big for the table. */
+            if (zz_random(k < 6 ? bits : 2*bits, k == 7, &v)) {
+                abort();
+            }
+
+            zz_err ret = zz_powm_table(&t, &v, &x);
+
+            if (ret == ZZ_OK) {
+                if (zz_powm(&u, &v, &m, &y) || zz_cmp(&x, &y) != ZZ_EQ
+                    || zz_powm_table(&t, &v, &v) || zz_cmp(&v, &y) != ZZ_EQ)
+                {
+                    abort();
+                }
+            }
+            else if (ret != ZZ_VAL || !zz_isneg(&v)) {
+                abort();
+            }
+        }
+        zz_powm_table_clear(&t);
+        zz_mod_ctx_clear(&ctx);
+        zz_clear(&m);
+        zz_clear(&u);
+        zz_clear(&v);
+        zz_clear(&x);
+        zz_clear(&y);
+    }
+}
+
 zz_err
 zz_ref_pow(const zz_t *u, uint64_t v, zz_t *w)
 {
@@ -303,7 +593,12 @@ int main(void)
     zz_testinit();
     zz_setup();
     check_powm_bulk();
+    check_powm_small_bulk();
+    check_powm_2exp_bulk();
     check_powm_examples();
+    check_mod_ctx_bulk();
+    check_powm_table_bulk();
+    check_mod_pow_multi_bulk();
     check_pow_bulk();
     check_pow_examples();
     zz_finish();
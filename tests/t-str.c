@@ -15,9 +15,8 @@
 void
 check_str_roundtrip(void)
 {
-    zz_bitcnt_t bs = 512;
-
     for (size_t i = 0; i < nsamples; i++) {
+        zz_bitcnt_t bs = i % 4 ? 512 : 4096;
         zz_t u;
 
         if (zz_init(&u) || zz_random(bs, true, &u)) {
@@ -125,6 +125,7 @@ square_worker(void *args)
     int *d = (int *)args;
     zz_t z;
 
+    max_size = 8*1000*1000; /* limits are per-thread */
     if (total_size || zz_init(&z) || zz_set(*d, &z)) {
         *d = 1;
         return NULL;
@@ -41,7 +41,11 @@
 #define ZZ_DIGIT_T_MAX UINT64_MAX
 #define ZZ_DIGIT_T_BYTES 8
 #define ZZ_DIGIT_T_BITS 64
-#ifndef _WIN32
+#if defined(ZZ_COMPACT_HEADER)
+   /* Capacity must fit in the info field, see below. */
+#  define ZZ_DIGITS_MAX ((INT32_C(1) << 27) - 1)
+#  define ZZ_BITS_MAX (zz_bitcnt_t)ZZ_DIGITS_MAX*ZZ_DIGIT_T_BITS
+#elif !defined(_WIN32)
 #  define ZZ_BITS_MAX UINT64_MAX
 #  define ZZ_DIGITS_MAX (zz_size_t)(ZZ_BITS_MAX/ZZ_DIGIT_T_BITS)
 #else
@@ -62,11 +66,52 @@ static _Thread_local jmp_buf zz_env;
 #endif
 #define TMP_OVERFLOW (setjmp(zz_env) == 1)
 
-#define ISNEG(u) ((u)->negative)
-#define SETNEG(u, v) ((v)->negative = u)
+#ifndef ZZ_COMPACT_HEADER
+#  define ISNEG(u) ((u)->negative)
+#  define SETNEG(u, v) ((v)->negative = u)
+
+#  define GETALLOC(u) ((u)->alloc)
+#  define SETALLOC(u, v) ((v)->alloc = (u))
+
+#  define GETFLAGS(u) ((unsigned int)(u)->flags)
+#  define SETFLAGS(u, v) ((v)->flags = (uint8_t)(u))
+
+#  define INLINE_DIGITS(u) ((u)->inline_digits)
+#else
+/* The info field holds capacity in lower 27 bits, then the sign bit and
+   flags in upper 4 bits. */
+#  define ZZ_ALLOC_MASK ((UINT32_C(1) << 27) - 1)
+#  define ZZ_NEG_BIT (UINT32_C(1) << 27)
+#  define ZZ_FLAGS_SHIFT 28
+
+#  define ISNEG(u) ((bool)((u)->info & ZZ_NEG_BIT))
+#  define SETNEG(u, v) \
+    ((v)->info = (u) ? (v)->info | ZZ_NEG_BIT : (v)->info & ~ZZ_NEG_BIT)
+
+#  define GETALLOC(u) ((zz_size_t)((u)->info & ZZ_ALLOC_MASK))
+#  define SETALLOC(u, v) \
+    ((v)->info = ((v)->info & ~ZZ_ALLOC_MASK) | (uint32_t)(u))
+
+#  define GETFLAGS(u) ((unsigned int)((u)->info >> ZZ_FLAGS_SHIFT))
+#  define SETFLAGS(u, v)                                    \
+    ((v)->info = ((v)->info & (ZZ_NEG_BIT | ZZ_ALLOC_MASK)) \
+                 | (uint32_t)(u) << ZZ_FLAGS_SHIFT)
+
+#  define INLINE_DIGITS(u) ((zz_digit_t *)NULL)
+#endif
+
+#define ISINLINE(u) ((u)->digits == INLINE_DIGITS(u))
+
+/* Bits of the flags field. */
+#define ZZ_FLAG_GROWTH 0x03U
+#define ZZ_FLAG_ARENA 0x04U
+#define ZZ_FLAG_MMAP 0x08U
 
-#define GETALLOC(u) ((u)->alloc)
-#define SETALLOC(u, v) ((v)->alloc = (u))
+#define GETGROWTH(u) ((zz_growth)(GETFLAGS(u) & ZZ_FLAG_GROWTH))
+#define SETGROWTH(u, v) \
+    SETFLAGS((GETFLAGS(v) & ~ZZ_FLAG_GROWTH) | (unsigned int)(u), v)
+#define ISARENA(u) (GETFLAGS(u) & ZZ_FLAG_ARENA)
+#define ISMMAP(u) (GETFLAGS(u) & ZZ_FLAG_MMAP)
 
 #define TMP_MPZ(z, u)                                   \
     mpz_t z;                                            \
@@ -87,9 +132,6 @@ static _Thread_local jmp_buf zz_env;
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define ABS_CAST(T, x) ((x) >= 0 ? ((T) (x)) : ((T) (((T) -((x) + 1)) + 1U)))
 
-void zz_set_memory_funcs(void *(*malloc) (size_t),
-                         void *(*realloc) (void *, size_t, size_t),
-                         void (*free) (void *, size_t));
 size_t zz_get_alloc_state(void);
 zz_err zz_inverse_euclidext(const zz_t *u, const zz_t *v, zz_t *t);
 zz_err zz_set_mpz_t(mpz_t u, zz_t *v);
@@ -10,13 +10,24 @@
     <https://www.gnu.org/licenses/>.
 */
 
+#include "zz-impl.h"
+
 #include <ctype.h>
 #include <float.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <math.h>
 
-#include "zz-impl.h"
+#if HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+#if HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+#ifndef __STDC_NO_ATOMICS__
+#  include <stdatomic.h>
+#endif
 
 #undef zz_set
 #undef zz_get
@@ -25,6 +36,11 @@
 #undef zz_sub
 #undef zz_mul
 #undef zz_div
+#undef zz_addmul
+#undef zz_submul
+#undef zz_iszero
+#undef zz_isneg
+#undef zz_isodd
 
 #if GMP_NAIL_BITS != 0
 #  error "GMP_NAIL_BITS expected to be 0"
@@ -52,6 +68,9 @@ zz_get_bitcnt_max(void)
 size_t
 zz_sizeof(const zz_t *u)
 {
+    if (ISINLINE(u)) {
+        return sizeof(zz_t);
+    }
     return sizeof(zz_t) + (size_t)GETALLOC(u)*sizeof(zz_digit_t);
 }
 
@@ -64,17 +83,17 @@ static struct {
     void (*free)(void *, size_t);
 } zz_state;
 
-#define TRACKER_SIZE_INCR 64
-_Thread_local struct {
-    size_t size;
-    size_t alloc;
-    void **ptrs;
-} zz_tracker = {0, 0, NULL};
+/* True between zz_setup() and zz_finish(). */
+static bool zz_ready = false;
 
 /* Thin wrappers over system allocation routines to
    support GMP's argument convention. */
 
-#define zz_malloc malloc
+static void *
+zz_malloc(size_t size)
+{
+    return malloc(size);
+}
 
 static void *
 zz_realloc(void *ptr, size_t old_size, size_t new_size)
@@ -102,7 +121,8 @@ zz_free(void *ptr, size_t size)
    an example.)  Those will use only zz_allocate_function() and
    zz_free_function() to allocate temporary storage (not for output variables).
    This allocation happens essentially in LIFO way and we take that into
-   account for optimization of the memory tracking.
+   account: temporaries are allocated from the per-thread stack (see below),
+   which is released at once on memory failure.
 
    Not all mpn_*() functions do memory allocation.  Sometimes it's obvious
    (e.g. mpn_cmp() or mpn_add/sub()), sometimes - not (e.g. mpn_get/set_str()
@@ -150,66 +170,296 @@ zz_free(void *ptr, size_t size)
        case of failure) in the scope of the setjmp invocation - with
        volatile type qualifier.  See zz_gcd() as an example. */
 
+/* Allocation statistics.  Counters are per-thread and updated only if
+   enabled.  Allocations are attributed to the outermost public function:
+   STATS_ENTER() declares a variable, that restores previous operation on
+   return (this requires support for the cleanup attribute, otherwise all
+   allocations are attributed to ZZ_STATS_OTHER). */
+
+static bool zz_stats_enabled = false;
+static _Thread_local zz_stats_t zz_stats;
+static _Thread_local zz_stats_op zz_stats_cur = ZZ_STATS_OTHER;
+
+void
+zz_stats_enable(bool enable)
+{
+    zz_stats_enabled = enable;
+}
+
+void
+zz_stats_get(zz_stats_t *stats)
+{
+    *stats = zz_stats;
+}
+
+void
+zz_stats_reset(void)
+{
+    memset(&zz_stats, 0, sizeof(zz_stats_t));
+}
+
+void
+zz_stats_merge(zz_stats_t *stats, const zz_stats_t *other)
+{
+    stats->live_bytes += other->live_bytes;
+    stats->peak_bytes += other->peak_bytes;
+    for (int i = 0; i < ZZ_STATS_OPS; i++) {
+        stats->ops[i].allocs += other->ops[i].allocs;
+        stats->ops[i].reallocs += other->ops[i].reallocs;
+        stats->ops[i].frees += other->ops[i].frees;
+        stats->ops[i].bytes += other->ops[i].bytes;
+        stats->ops[i].scratch_bytes += other->ops[i].scratch_bytes;
+    }
+}
+
+static inline zz_stats_op
+zz_stats_enter(zz_stats_op op)
+{
+    zz_stats_op prev = zz_stats_cur;
+
+    if (prev == ZZ_STATS_OTHER) {
+        zz_stats_cur = op;
+    }
+    return prev;
+}
+
+static inline void
+zz_stats_leave(zz_stats_op *prev)
+{
+    zz_stats_cur = *prev;
+}
+
+#if defined(__GNUC__)
+#  define STATS_ENTER(op)                                    \
+    __attribute__((cleanup(zz_stats_leave))) zz_stats_op     \
+        zz_stats_prev = zz_stats_enter(op);                  \
+    (void)zz_stats_prev
+#else
+#  define STATS_ENTER(op)
+#endif
+
+#define STATS_INC(field, n)                            \
+    do {                                               \
+        if (zz_stats_enabled) {                        \
+            zz_stats.ops[zz_stats_cur].field += (n);   \
+        }                                              \
+    } while (0)
+
+#define STATS_LIVE(n)                                              \
+    do {                                                           \
+        if (zz_stats_enabled) {                                    \
+            zz_stats.live_bytes += (n);                            \
+            zz_stats.peak_bytes = MAX(zz_stats.peak_bytes,         \
+                                      zz_stats.live_bytes);        \
+        }                                                          \
+    } while (0)
+
+/* Temporary allocations are served from the per-thread stack of memory
+   chunks.  Each block is preceded by a header with a link to the previous
+   block in the chunk and the block size.  Freeing of the top block (the
+   common case) pops it, other blocks are only marked as freed and popped
+   later.  The top block can be extended in place.  Thus, usually, neither
+   allocation nor deallocation require calls to the system allocator.
+
+   One chunk of the default size is kept for reuse, when all allocations
+   from the stack are freed.
+
+   There are two such stacks: one for GMP's temporaries and one for work
+   buffers of the library itself (see TMP_ALLOC).  Only the first one is
+   released at once on memory failure. */
+
+typedef struct zz_scratch_block {
+    struct zz_scratch_block *prev;
+    size_t size; /* lowest bit is set for freed blocks */
+} zz_scratch_block;
+
+typedef struct zz_scratch_chunk {
+    struct zz_scratch_chunk *prev;
+    zz_scratch_block *last;
+    char *top;
+    char *end;
+    zz_scratch_block data[];
+} zz_scratch_chunk;
+
+typedef struct {
+    zz_scratch_chunk *chunk;
+    size_t used;
+} zz_scratch_t;
+
+#define SCRATCH_CHUNK_SIZE (256*1024)
+#define SCRATCH_ROUND(n) \
+    (((n) + sizeof(zz_scratch_block) - 1) & ~(sizeof(zz_scratch_block) - 1))
+
+static _Thread_local zz_scratch_t zz_scratch = {NULL, 0};
+static _Thread_local zz_scratch_t zz_tmp = {NULL, 0};
+
+static void zz_thread_register(void);
+
+static size_t
+zz_scratch_chunk_size(const zz_scratch_chunk *chunk)
+{
+    return (size_t)(chunk->end - (const char *)chunk);
+}
+
+/* Free all chunks of the stack. */
+static void
+zz_scratch_release(zz_scratch_t *stack)
+{
+    while (stack->chunk) {
+        zz_scratch_chunk *chunk = stack->chunk;
+
+        stack->chunk = chunk->prev;
+        zz_state.free(chunk, zz_scratch_chunk_size(chunk));
+    }
+    stack->used = 0;
+}
+
 static void *
-zz_reallocate_function(void *ptr, size_t old_size, size_t new_size)
+zz_scratch_alloc(zz_scratch_t *stack, size_t size)
 {
-    if (zz_tracker.size >= zz_tracker.alloc) {
-        /* Reallocation shouldn't be required.  Unless...
-           you are using the mpz_t from the GNU GMP with
-           our memory functions. */
-        void **tmp = zz_tracker.ptrs;
-        size_t old_alloc = zz_tracker.alloc;
-
-        zz_tracker.alloc += TRACKER_SIZE_INCR;
-        zz_tracker.ptrs = zz_state.realloc(zz_tracker.ptrs,
-                                           old_alloc * sizeof(void *),
-                                           zz_tracker.alloc * sizeof(void *));
-        if (!zz_tracker.ptrs) {
-            /* LCOV_EXCL_START */
-            zz_tracker.alloc = old_alloc;
-            zz_tracker.ptrs = tmp;
-            goto err;
-            /* LCOV_EXCL_STOP */
+    zz_scratch_chunk *chunk = stack->chunk;
+
+    size = SCRATCH_ROUND(size);
+
+    size_t need = sizeof(zz_scratch_block) + size;
+
+    if (!chunk || (size_t)(chunk->end - chunk->top) < need) {
+        size_t chunk_size = sizeof(zz_scratch_chunk) + MAX(need,
+                                                           SCRATCH_CHUNK_SIZE);
+
+        chunk = zz_state.malloc(chunk_size);
+        if (!chunk) {
+            return NULL;
+        }
+        zz_thread_register();
+        chunk->prev = stack->chunk;
+        chunk->last = NULL;
+        chunk->top = (char *)chunk->data;
+        chunk->end = (char *)chunk + chunk_size;
+        stack->chunk = chunk;
+    }
+
+    zz_scratch_block *block = (zz_scratch_block *)chunk->top;
+
+    block->prev = chunk->last;
+    block->size = size;
+    chunk->last = block;
+    chunk->top += need;
+    stack->used += size;
+    STATS_INC(scratch_bytes, size);
+    return block + 1;
+}
+
+/* Return chunk, containing ptr, or NULL for foreign pointers. */
+static zz_scratch_chunk *
+zz_scratch_find(const zz_scratch_t *stack, const void *ptr)
+{
+    for (zz_scratch_chunk *chunk = stack->chunk; chunk; chunk = chunk->prev) {
+        if ((const char *)chunk->data < (const char *)ptr
+            && (const char *)ptr < chunk->top)
+        {
+            return chunk;
         }
     }
-    if (!ptr) {
-        void *ret = zz_state.malloc(new_size);
+    return NULL;
+}
 
-        if (!ret) {
-            goto err;
+/* Mark block as freed, then pop freed blocks from the top of the stack
+   and free empty chunks. */
+static void
+zz_scratch_free(zz_scratch_t *stack, void *ptr)
+{
+    zz_scratch_block *block = (zz_scratch_block *)ptr - 1;
+    zz_scratch_chunk *chunk = stack->chunk;
+
+    stack->used -= block->size;
+    block->size |= 1;
+    while (chunk) {
+        while (chunk->last && chunk->last->size & 1) {
+            chunk->top = (char *)chunk->last;
+            chunk->last = chunk->last->prev;
         }
-        zz_tracker.ptrs[zz_tracker.size] = ret;
-        zz_tracker.size++;
-        return ret;
+        if (chunk->last
+            || (!chunk->prev && (zz_scratch_chunk_size(chunk)
+                                 == sizeof(zz_scratch_chunk)
+                                    + SCRATCH_CHUNK_SIZE)))
+        {
+            break;
+        }
+        stack->chunk = chunk->prev;
+        zz_state.free(chunk, zz_scratch_chunk_size(chunk));
+        chunk = stack->chunk;
     }
+}
 
-    size_t i = zz_tracker.size - 1;
+/* Resize block, allocated from the stack. */
+static void *
+zz_scratch_realloc(zz_scratch_t *stack, zz_scratch_chunk *chunk, void *ptr,
+                   size_t size)
+{
+    zz_scratch_block *block = (zz_scratch_block *)ptr - 1;
 
-    for (;; i--) {
-        if (zz_tracker.ptrs[i] == ptr) {
-            break;
+    size = SCRATCH_ROUND(size);
+    if (block == chunk->last && size <= (size_t)(chunk->end - (char *)ptr)) {
+        if (size > block->size) {
+            STATS_INC(scratch_bytes, size - block->size);
         }
+        stack->used += size;
+        stack->used -= block->size;
+        block->size = size;
+        chunk->top = (char *)ptr + size;
+        return ptr;
     }
 
-    void *ret = zz_state.realloc(ptr, old_size, new_size);
+    void *ret = zz_scratch_alloc(stack, size);
 
-    if (!ret) {
-        goto err; /* LCOV_EXCL_LINE */
+    if (ret) {
+        memcpy(ret, ptr, MIN(block->size, size));
+        zz_scratch_free(stack, ptr);
     }
-    zz_tracker.ptrs[i] = ret;
     return ret;
-err:
-    i = zz_tracker.size - 1;
-    while (zz_tracker.size > 0) {
-        zz_state.free(zz_tracker.ptrs[i], 0);
-        zz_tracker.ptrs[i] = NULL;
-        zz_tracker.size--;
-        i--;
+}
+
+/* Work buffers of the library are allocated by the TMP_ALLOC macro (which
+   returns NULL on failure) and must be freed by TMP_FREE.  These pointers
+   can be safely freed in the "if (TMP_OVERFLOW)" block. */
+static void
+zz_tmp_free(void *ptr)
+{
+    if (ptr) {
+        zz_scratch_free(&zz_tmp, ptr);
+    }
+}
+
+#define TMP_ALLOC(size) zz_scratch_alloc(&zz_tmp, (size))
+#define TMP_FREE(ptr) zz_tmp_free(ptr)
+
+static void *
+zz_reallocate_function(void *ptr, size_t old_size, size_t new_size)
+{
+    void *ret;
+
+    if (!ptr) {
+        ret = zz_scratch_alloc(&zz_scratch, new_size);
+    }
+    else {
+        zz_scratch_chunk *chunk = zz_scratch_find(&zz_scratch, ptr);
+
+        if (chunk) {
+            ret = zz_scratch_realloc(&zz_scratch, chunk, ptr, new_size);
+        }
+        else {
+            /* Not a temporary allocation.  Unless...
+               you are using the mpz_t from the GNU GMP with
+               our memory functions. */
+            ret = zz_state.realloc(ptr, old_size, new_size);
+        }
+    }
+    if (!ret) {
+        zz_scratch_release(&zz_scratch);
+        longjmp(zz_env, 1);
     }
-    zz_state.free(zz_tracker.ptrs, zz_tracker.alloc * sizeof(void *));
-    zz_tracker.alloc = 0;
-    zz_tracker.ptrs = NULL;
-    longjmp(zz_env, 1);
+    return ret;
 }
 
 static void *
@@ -221,26 +471,12 @@ zz_allocate_function(size_t size)
 static void
 zz_free_function(void *ptr, size_t size)
 {
-    for (size_t i = zz_tracker.size - 1; i >= 0; i--) {
-        if (zz_tracker.ptrs[i] == ptr) {
-            zz_tracker.ptrs[i] = NULL;
-            break;
-        }
+    if (zz_scratch_find(&zz_scratch, ptr)) {
+        zz_scratch_free(&zz_scratch, ptr);
     }
-    zz_state.free(ptr, size);
-
-    size_t i = zz_tracker.size - 1;
-
-    while (zz_tracker.size > 0) {
-        if (zz_tracker.ptrs[i]) {
-            return;
-        }
-        zz_tracker.size--;
-        i--;
+    else {
+        zz_state.free(ptr, size);
     }
-    zz_state.free(zz_tracker.ptrs, zz_tracker.alloc * sizeof(void *));
-    zz_tracker.alloc = 0;
-    zz_tracker.ptrs = NULL;
 }
 
 zz_err
@@ -255,6 +491,7 @@ zz_setup(void)
     zz_state.malloc = &zz_malloc;
     zz_state.realloc = &zz_realloc;
     zz_state.free = &zz_free;
+    zz_ready = true;
     return ZZ_OK;
 }
 
@@ -272,6 +509,9 @@ zz_set_memory_funcs(void *(*malloc) (size_t),
     if (!free) {
         free = zz_free;
     }
+    zz_pool_flush();
+    zz_scratch_release(&zz_scratch);
+    zz_scratch_release(&zz_tmp);
     zz_state.malloc = malloc;
     zz_state.realloc = realloc;
     zz_state.free = free;
@@ -280,2310 +520,4939 @@ zz_set_memory_funcs(void *(*malloc) (size_t),
 size_t
 zz_get_alloc_state(void)
 {
-    return zz_tracker.alloc;
+    return zz_scratch.used + zz_tmp.used;
 }
 
 void
 zz_finish(void)
 {
+    zz_pool_flush();
+    zz_scratch_release(&zz_scratch);
+    zz_scratch_release(&zz_tmp);
     mp_set_memory_functions(zz_state.default_allocate_func,
                             zz_state.default_reallocate_func,
                             zz_state.default_free_func);
     zz_state.malloc = &zz_malloc;
     zz_state.realloc = &zz_realloc;
     zz_state.free = &zz_free;
+    zz_ready = false;
 }
 
-zz_err
-zz_init(zz_t *u)
+/* Per-thread pool of digit buffers.  Buffers in the pool have capacity of
+   POOL_MIN_DIGITS*2**k digits (size class k) and are kept in singly
+   linked lists, using the first digit of a free buffer as a link. */
+
+#define POOL_MIN_DIGITS 4
+#define POOL_CLASSES 24
+
+static struct {
+    zz_size_t max_digits;
+    size_t max_count;
+} zz_pool_limits = {1024, 16};
+
+static _Thread_local struct {
+    zz_digit_t *head[POOL_CLASSES];
+    size_t count[POOL_CLASSES];
+} zz_pool;
+
+#if HAVE_PTHREAD_H
+static pthread_key_t zz_thread_key;
+static pthread_once_t zz_thread_once = PTHREAD_ONCE_INIT;
+static _Thread_local bool zz_thread_registered = false;
+
+static void
+zz_thread_exit(void *arg)
 {
-    SETNEG(false, u);
-    SETALLOC(0, u);
-    u->size = 0;
-    u->digits = NULL;
-    return ZZ_OK;
+    zz_pool_flush();
+    zz_scratch_release(&zz_scratch);
+    zz_scratch_release(&zz_tmp);
 }
 
-static zz_err
-zz_resize(zz_size_t size, zz_t *u)
+static void
+zz_thread_key_init(void)
 {
-    if (GETALLOC(u) >= size) {
-        u->size = size;
-        if (!u->size) {
-            SETNEG(false, u);
-        }
-        return ZZ_OK;
-    }
-
-    zz_size_t alloc = size;
-    zz_digit_t *t = u->digits;
+    (void)pthread_key_create(&zz_thread_key, zz_thread_exit);
+}
 
-    u->digits = realloc(u->digits, (size_t)alloc * ZZ_DIGIT_T_BYTES);
-    if (u->digits) {
-        SETALLOC(alloc, u);
-        u->size = alloc;
-        return ZZ_OK;
+/* Arrange to release per-thread caches, when the thread exits. */
+static void
+zz_thread_register(void)
+{
+    if (!zz_thread_registered) {
+        (void)pthread_once(&zz_thread_once, zz_thread_key_init);
+        (void)pthread_setspecific(zz_thread_key, &zz_pool);
+        zz_thread_registered = true;
     }
-    /* LCOV_EXCL_START */
-    u->digits = t;
-    return ZZ_MEM;
-    /* LCOV_EXCL_STOP */
 }
-
-void
-zz_clear(zz_t *u)
+#else
+static void
+zz_thread_register(void)
 {
-    free(u->digits);
-    SETNEG(false, u);
-    SETALLOC(0, u);
-    u->size = 0;
-    u->digits = NULL;
 }
+#endif
 
-inline static void
-zz_normalize(zz_t *u)
+/* Return size class for buffer of given capacity, or -1 if
+   the capacity is not pooled. */
+static int
+zz_pool_class(zz_size_t alloc)
 {
-    while (u->size && u->digits[u->size - 1] == 0) {
-        u->size--;
+    if (alloc > zz_pool_limits.max_digits || alloc < POOL_MIN_DIGITS
+        || (alloc & (alloc - 1)))
+    {
+        return -1;
     }
-    if (!u->size) {
-        SETNEG(false, u);
+
+    int k = 0;
+
+    while ((POOL_MIN_DIGITS << k) < alloc) {
+        k++;
     }
+    return k < POOL_CLASSES ? k : -1;
 }
 
-zz_ord
-zz_cmp(const zz_t *u, const zz_t *v)
+/* Return capacity of the buffer for alloc digits: it's rounded up to the
+   size class, if such buffers are pooled. */
+static zz_size_t
+zz_pool_round(zz_size_t alloc)
 {
-    if (u == v) {
-        return ZZ_EQ;
+    if (alloc > zz_pool_limits.max_digits) {
+        return alloc;
     }
 
-    bool u_negative = ISNEG(u);
-    zz_ord res = u_negative ? ZZ_LT : ZZ_GT;
+    zz_size_t cap = POOL_MIN_DIGITS;
 
-    if (u_negative != ISNEG(v)) {
-        return res;
-    }
-    else if (u->size != v->size) {
-        return (u->size < v->size) ? -res : res;
+    while (cap < alloc) {
+        cap *= 2;
     }
-    res = mpn_cmp(u->digits, v->digits, u->size);
-    return u_negative ? -res : res;
+    return zz_pool_class(cap) >= 0 ? cap : alloc;
 }
 
-zz_ord
-zz_cmp_i64(const zz_t *u, int64_t v)
+/* Allocate buffer for at least *alloc digits and set *alloc to its
+   actual capacity.  If exact is true, the capacity isn't rounded, so the
+   pool is used only if *alloc is the capacity of a size class. */
+static zz_digit_t *
+zz_digits_alloc(zz_size_t *alloc, bool exact)
 {
-    bool u_negative = ISNEG(u);
-    zz_ord res = u_negative ? ZZ_LT : ZZ_GT;
+    zz_size_t cap = exact ? *alloc : zz_pool_round(*alloc);
+    int k = zz_pool_class(cap);
 
-    if (u_negative != (v < 0) || u->size > 1) {
-        return res;
-    }
-    else if (!u->size) {
-        return v ? -res : ZZ_EQ;
+    *alloc = cap;
+    if (k >= 0 && zz_pool.head[k]) {
+        zz_digit_t *ptr = zz_pool.head[k];
+
+        memcpy(&zz_pool.head[k], ptr, sizeof(zz_digit_t *));
+        zz_pool.count[k]--;
+        return ptr;
     }
+    return zz_state.malloc((size_t)cap * ZZ_DIGIT_T_BYTES);
+}
 
-    zz_digit_t uu = u->digits[0], uv = ABS_CAST(zz_digit_t, v);
+static void
+zz_digits_free(zz_digit_t *ptr, zz_size_t alloc)
+{
+    int k = zz_pool_class(alloc);
 
-    if (uu == uv) {
-        return ZZ_EQ;
+    if (k >= 0 && zz_pool.count[k] < zz_pool_limits.max_count) {
+        zz_thread_register();
+        memcpy(ptr, &zz_pool.head[k], sizeof(zz_digit_t *));
+        zz_pool.head[k] = ptr;
+        zz_pool.count[k]++;
+        return;
     }
-    return uu > uv ? res : -res;
+    zz_state.free(ptr, (size_t)alloc * ZZ_DIGIT_T_BYTES);
 }
 
-zz_err
-zz_set_mpz_t(mpz_t u, zz_t *v)
+void
+zz_pool_flush(void)
 {
-    if (zz_resize(abs(u->_mp_size), v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    for (int k = 0; k < POOL_CLASSES; k++) {
+        while (zz_pool.head[k]) {
+            zz_digit_t *ptr = zz_pool.head[k];
+
+            memcpy(&zz_pool.head[k], ptr, sizeof(zz_digit_t *));
+            zz_state.free(ptr, (size_t)(POOL_MIN_DIGITS << k)
+                               * ZZ_DIGIT_T_BYTES);
+        }
+        zz_pool.count[k] = 0;
     }
-    mpn_copyi(v->digits, u->_mp_d, v->size);
-    SETNEG(u->_mp_size < 0, v);
-    return ZZ_OK;
 }
 
+void
+zz_pool_set_limits(zz_size_t max_digits, size_t max_count)
+{
+    zz_pool_flush();
+    zz_pool_limits.max_digits = max_digits;
+    zz_pool_limits.max_count = max_count;
+}
+
+/* In the copy-on-write mode, heap buffers for digits are preceded by one
+   digit, holding the reference count.  Copies of integers (by zz_pos())
+   share digits, until one of them is resized, i.e. before any change of
+   digits (see zz_resize()).  Shared digits are never changed in place, so
+   only the reference count is accessed concurrently.
+
+   The header is present depending on the mode, so the mode can be changed
+   only before zz_setup() (or after zz_finish()), when there are no integers
+   with heap storage. */
+
+static bool zz_cow = false;
+
 zz_err
-zz_set_i32(int32_t u, zz_t *v)
+zz_set_copy_on_write(bool enable)
 {
-    if (!u) {
-        v->size = 0;
-        SETNEG(false, v);
-        return ZZ_OK;
+    if (zz_ready) {
+        return ZZ_VAL;
     }
-    if (zz_resize(1, v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+#ifdef __STDC_NO_ATOMICS__
+    if (enable) {
+        return ZZ_VAL;
     }
-    SETNEG(u < 0, v);
-    v->digits[0] = (zz_digit_t)abs(u);
+#endif
+    zz_cow = enable;
     return ZZ_OK;
 }
 
-zz_err
-zz_set_i64(int64_t u, zz_t *v)
+#ifndef __STDC_NO_ATOMICS__
+#  define REFCNT(digits) ((_Atomic size_t *)((digits) - 1))
+#  define ISCOW(u) (zz_cow && !ISINLINE(u) && GETALLOC(u) && !ISARENA(u) \
+                    && !ISMMAP(u))
+#  define ISSHARED(u)                                                 \
+    (ISCOW(u) && atomic_load_explicit(REFCNT((u)->digits),            \
+                                      memory_order_acquire) > 1)
+#else
+#  define ISCOW(u) false
+#  define ISSHARED(u) false
+#endif
+
+#define COW_HDR (zz_cow ? 1 : 0)
+
+/* Same as zz_digits_alloc(), but adds the header with the reference count
+   in the copy-on-write mode. */
+static zz_digit_t *
+zz_heap_alloc(zz_size_t *alloc, bool exact)
 {
-    if (!u) {
-        v->size = 0;
-        SETNEG(false, v);
-        return ZZ_OK;
+    zz_size_t cap = *alloc + COW_HDR;
+    zz_digit_t *t = zz_digits_alloc(&cap, exact);
+
+    if (!t) {
+        return NULL; /* LCOV_EXCL_LINE */
     }
-    if (zz_resize(1, v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+#ifndef __STDC_NO_ATOMICS__
+    if (zz_cow) {
+        t++;
+        atomic_init(REFCNT(t), 1);
     }
-    SETNEG(u < 0, v);
-    v->digits[0] = ABS_CAST(zz_digit_t, u);
-    return ZZ_OK;
+#endif
+    *alloc = cap - COW_HDR;
+    return t;
 }
 
-zz_err
-zz_set_u64(uint64_t u, zz_t *v)
+/* Release heap buffer for digits, return true if it was freed (i.e. it
+   wasn't shared). */
+static bool
+zz_heap_free(zz_digit_t *ptr, zz_size_t alloc)
 {
-    if (!u) {
-        v->size = 0;
-        SETNEG(false, v);
-        return ZZ_OK;
-    }
-    if (zz_resize(1, v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+#ifndef __STDC_NO_ATOMICS__
+    if (zz_cow) {
+        if (atomic_fetch_sub_explicit(REFCNT(ptr), 1,
+                                      memory_order_acq_rel) > 1)
+        {
+            return false;
+        }
+        ptr--;
     }
-    SETNEG(false, v);
-    v->digits[0] = u;
-    return ZZ_OK;
+#endif
+    zz_digits_free(ptr, alloc + COW_HDR);
+    return true;
 }
 
-#define DIGITS_PER_DOUBLE ((53 + ZZ_DIGIT_T_BITS - 2) / ZZ_DIGIT_T_BITS + 1)
+/* Storage for digits of huge integers may be mapped directly from the OS.
+   Such buffers are grown by mremap(), which moves pages instead of copying
+   digits, and are unmapped at once by zz_clear().  The capacity is rounded
+   up to whole pages.  Custom memory functions disable this. */
 
-zz_err
-zz_set_double(double u, zz_t *v)
+static size_t zz_mmap_threshold = 0;
+
+void
+zz_set_mmap_threshold(size_t bytes)
 {
-#if defined(__MINGW32__) && defined(__GNUC__)
-#  pragma GCC diagnostic push
-#  pragma GCC diagnostic ignored "-Wfloat-conversion"
-#endif
-    if (isnan(u)) {
-#if defined(__MINGW32__) && defined(__GNUC__)
-#  pragma GCC diagnostic pop
-#endif
-        return ZZ_VAL;
-    }
-#if defined(__MINGW32__) && defined(__GNUC__)
-#  pragma GCC diagnostic push
-#  pragma GCC diagnostic ignored "-Wfloat-conversion"
-#endif
-    if (isinf(u)) {
-#if defined(__MINGW32__) && defined(__GNUC__)
-#  pragma GCC diagnostic pop
-#endif
-        return ZZ_BUF;
-    }
-    if (zz_resize(DIGITS_PER_DOUBLE, v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
-    }
+    zz_mmap_threshold = bytes;
+}
 
-    /* v has enough space to prevent new allocation by GMP */
-    TMP_MPZ(z, v);
-    mpz_set_d(z, u);
-    SETNEG(u < 0, v);
-    v->size = abs(z->_mp_size);
-    return ZZ_OK;
+#if HAVE_SYS_MMAN_H
+static bool
+zz_mmap_wanted(zz_size_t alloc)
+{
+    return zz_mmap_threshold && zz_state.malloc == zz_malloc
+           && alloc > ZZ_INLINE_DIGITS
+           && (size_t)alloc*ZZ_DIGIT_T_BYTES >= zz_mmap_threshold;
 }
 
-zz_err
-zz_get_i32(const zz_t *u, int32_t *v)
+static size_t
+zz_mmap_bytes(zz_size_t alloc)
 {
-    zz_size_t n = u->size;
+    static size_t page_size = 0;
 
-    if (!n) {
-        *v = 0;
-        return ZZ_OK;
-    }
-    if (n > 1) {
-        return ZZ_BUF;
+    if (!page_size) {
+        long ret = sysconf(_SC_PAGESIZE);
+
+        page_size = ret > 0 ? (size_t)ret : 4096;
     }
+    return ((size_t)alloc*ZZ_DIGIT_T_BYTES + page_size - 1) & ~(page_size - 1);
+}
 
-    zz_digit_t uv = u->digits[0];
+/* Map storage for at least *alloc digits and set *alloc to its actual
+   capacity.  If ptr isn't NULL, it's a mapped buffer with capacity of
+   old_alloc digits, which is remapped, preserving content. */
+static zz_digit_t *
+zz_mmap_digits(zz_digit_t *ptr, zz_size_t old_alloc, zz_size_t *alloc)
+{
+    size_t bytes = zz_mmap_bytes(*alloc);
+    void *t;
 
-    if (ISNEG(u)) {
-        if (uv <= INT32_MAX + (zz_digit_t)1) {
-            *v = -1 - (int32_t)((uv - 1) & INT32_MAX);
-            return ZZ_OK;
+    if (ptr) {
+        size_t old_bytes = zz_mmap_bytes(old_alloc);
+
+        if (old_bytes == bytes) {
+            *alloc = old_alloc;
+            return ptr;
         }
+#if HAVE_MREMAP
+        t = mremap(ptr, old_bytes, bytes, MREMAP_MAYMOVE);
+#else
+        t = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (t != MAP_FAILED) {
+            memcpy(t, ptr, MIN(old_bytes, bytes));
+            (void)munmap(ptr, old_bytes);
+        }
+#endif
     }
     else {
-        if (uv <= INT32_MAX) {
-            *v = (int32_t)uv;
-            return ZZ_OK;
-        }
+        t = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     }
-    return ZZ_BUF;
+    if (t == MAP_FAILED) {
+        return NULL; /* LCOV_EXCL_LINE */
+    }
+#if HAVE_MADVISE && defined(MADV_HUGEPAGE)
+    (void)madvise(t, bytes, MADV_HUGEPAGE);
+#endif
+    *alloc = (zz_size_t)MIN(bytes/ZZ_DIGIT_T_BYTES, (size_t)ZZ_DIGITS_MAX);
+    return t;
 }
 
-zz_err
-zz_get_i64(const zz_t *u, int64_t *v)
+static void
+zz_munmap_digits(zz_digit_t *ptr, zz_size_t alloc)
 {
-    zz_size_t n = u->size;
+    (void)munmap(ptr, zz_mmap_bytes(alloc));
+}
+#else
+#  define zz_mmap_wanted(alloc) false
+#  define zz_mmap_digits(ptr, old_alloc, alloc) NULL
+#  define zz_munmap_digits(ptr, alloc)
+#endif
 
-    if (!n) {
-        *v = 0;
-        return ZZ_OK;
-    }
-    if (n > 1) {
-        return ZZ_BUF;
-    }
+static zz_growth zz_default_growth = ZZ_GROWTH_GEOMETRIC;
 
-    zz_digit_t uv = u->digits[0];
+/* Return the growth policy of u, the default one is resolved. */
+static zz_growth
+zz_growth_policy(const zz_t *u)
+{
+    zz_growth policy = GETGROWTH(u);
 
-    if (ISNEG(u)) {
-        if (uv <= INT64_MAX + (zz_digit_t)1) {
-            *v = -1 - (int64_t)((uv - 1) & INT64_MAX);
-            return ZZ_OK;
-        }
-    }
-    else {
-        if (uv <= INT64_MAX) {
-            *v = (int64_t)uv;
-            return ZZ_OK;
-        }
-    }
-    return ZZ_BUF;
+    return policy == ZZ_GROWTH_DEFAULT ? zz_default_growth : policy;
 }
 
-zz_err
-zz_get_u32(const zz_t *u, uint32_t *v)
+void
+zz_set_default_growth(zz_growth policy)
 {
-    if (ISNEG(u)) {
-        return ZZ_VAL;
+    if (policy == ZZ_GROWTH_DEFAULT) {
+        policy = ZZ_GROWTH_GEOMETRIC;
     }
-    if (!u->size) {
-        *v = 0;
-        return ZZ_OK;
-    }
-    if (u->size > 1 || u->digits[0] > UINT32_MAX) {
-        return ZZ_BUF;
-    }
-    *v = (uint32_t)u->digits[0];
-    return ZZ_OK;
+    zz_default_growth = policy;
 }
 
-zz_err
-zz_get_u64(const zz_t *u, uint64_t *v)
+void
+zz_set_growth(zz_t *u, zz_growth policy)
 {
-    if (ISNEG(u)) {
-        return ZZ_VAL;
+    SETGROWTH(policy, u);
+}
+
+#define GROWTH_MIN_DIGITS 4
+
+/* Return new capacity of u, that can hold at least size digits. */
+static zz_size_t
+zz_grow(const zz_t *u, zz_size_t size)
+{
+    if (zz_growth_policy(u) == ZZ_GROWTH_EXACT) {
+        return size;
     }
-    if (u->size > 1) {
-        return ZZ_BUF;
+
+    zz_size_t alloc = GETALLOC(u), incr = alloc/2;
+
+    alloc = alloc > ZZ_DIGITS_MAX - incr ? ZZ_DIGITS_MAX : alloc + incr;
+    return MAX(MAX(alloc, size), GROWTH_MIN_DIGITS);
+}
+
+/* Digits of arena-bound integers are allocated from chunks of the arena.
+   Each block is preceded by one digit, holding pointer to the arena. */
+struct zz_arena_chunk {
+    struct zz_arena_chunk *next;
+    size_t size;
+    zz_digit_t data[];
+};
+
+#define ARENA_CHUNK_SIZE 8192
+
+static zz_err
+zz_arena_add_chunk(zz_arena_t *arena, size_t size)
+{
+    size = MAX(size, arena->chunk_size);
+
+    size_t bytes = sizeof(struct zz_arena_chunk) + size*ZZ_DIGIT_T_BYTES;
+    struct zz_arena_chunk *chunk = zz_state.malloc(bytes);
+
+    if (!chunk) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    *v = u->size ? u->digits[0] : 0;
+    chunk->size = bytes;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->top = chunk->data;
+    arena->end = chunk->data + size;
     return ZZ_OK;
 }
 
-bool
-zz_iszero(const zz_t *u)
+static zz_digit_t *
+zz_arena_alloc(zz_arena_t *arena, zz_size_t alloc)
 {
-    return u->size == 0;
+    size_t size = (size_t)alloc + 1;
+
+    if ((size_t)(arena->end - arena->top) < size
+        && zz_arena_add_chunk(arena, size))
+    {
+        return NULL; /* LCOV_EXCL_LINE */
+    }
+
+    zz_digit_t *t = arena->top;
+
+    memcpy(t, &arena, sizeof(zz_arena_t *));
+    arena->top += size;
+    return t + 1;
 }
 
-bool
-zz_isneg(const zz_t *u)
+zz_err
+zz_arena_init(zz_arena_t *arena, size_t chunk_size)
 {
-    return ISNEG(u);
+    arena->chunks = NULL;
+    arena->top = arena->end = NULL;
+    arena->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK_SIZE;
+    return zz_arena_add_chunk(arena, 0);
 }
 
-bool
-zz_isodd(const zz_t *u)
+void
+zz_arena_reset(zz_arena_t *arena)
 {
-    return u->size && u->digits[0] & 1;
+    struct zz_arena_chunk *chunk = arena->chunks->next;
+
+    while (chunk) {
+        struct zz_arena_chunk *next = chunk->next;
+
+        zz_state.free(chunk, chunk->size);
+        chunk = next;
+    }
+    arena->chunks->next = NULL;
+    arena->top = arena->chunks->data;
 }
 
-zz_err
-zz_pos(const zz_t *u, zz_t *v)
+void
+zz_arena_clear(zz_arena_t *arena)
 {
-    if (u != v) {
-        if (!u->size) {
-            return zz_set_i64(0, v);
-        }
-        if (zz_resize(u->size, v)) {
-            return ZZ_MEM; /* LCOV_EXCL_LINE */
-        }
-        SETNEG(ISNEG(u), v);
-        mpn_copyi(v->digits, u->digits, u->size);
+    struct zz_arena_chunk *chunk = arena->chunks;
+
+    while (chunk) {
+        struct zz_arena_chunk *next = chunk->next;
+
+        zz_state.free(chunk, chunk->size);
+        chunk = next;
     }
-    return ZZ_OK;
+    arena->chunks = NULL;
+    arena->top = arena->end = NULL;
 }
 
 zz_err
-zz_abs(const zz_t *u, zz_t *v)
+zz_init_arena(zz_t *u, zz_arena_t *arena)
 {
-    if (u != v && zz_pos(u, v)) {
+    zz_digit_t *t = zz_arena_alloc(arena, ZZ_INLINE_DIGITS);
+
+    if (!t) {
         return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    SETNEG(false, v);
+    SETNEG(false, u);
+    SETFLAGS(ZZ_FLAG_ARENA, u);
+    SETALLOC(ZZ_INLINE_DIGITS, u);
+    u->size = 0;
+    u->digits = t;
     return ZZ_OK;
 }
 
-zz_err
-zz_neg(const zz_t *u, zz_t *v)
+/* Read-only integers from ZZ_SMALL_MIN to ZZ_SMALL_MAX, sharing digits
+   from the small_digits table. */
+#define D4(v) (v), (v) + 1, (v) + 2, (v) + 3
+#define D16(v) D4(v), D4((v) + 4), D4((v) + 8), D4((v) + 12)
+#define D64(v) D16(v), D16((v) + 16), D16((v) + 32), D16((v) + 48)
+
+static const zz_digit_t small_digits[] = {
+    D64(0), D64(64), D64(128), D64(192), ZZ_SMALL_MAX,
+};
+
+#define S1(v) ZZ_CONST_INIT((v) < 0, (v) != 0,                      \
+                            small_digits + ((v) < 0 ? -(v) : (v)))
+#define S4(v) S1(v), S1((v) + 1), S1((v) + 2), S1((v) + 3)
+#define S16(v) S4(v), S4((v) + 4), S4((v) + 8), S4((v) + 12)
+#define S64(v) S16(v), S16((v) + 16), S16((v) + 32), S16((v) + 48)
+
+static const zz_t small_ints[] = {
+    S64(-256), S64(-192), S64(-128), S64(-64),
+    S64(0), S64(64), S64(128), S64(192), S1(ZZ_SMALL_MAX),
+};
+
+static_assert(sizeof(small_digits)/sizeof(small_digits[0])
+              == ZZ_SMALL_MAX + 1, "small_digits");
+static_assert(sizeof(small_ints)/sizeof(small_ints[0])
+              == ZZ_SMALL_MAX - ZZ_SMALL_MIN + 1, "small_ints");
+
+const zz_t *
+zz_small(int64_t v)
 {
-    if (u != v && zz_pos(u, v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
-    }
-    if (v->size) {
-        SETNEG(!ISNEG(u), v);
+    if (v < ZZ_SMALL_MIN || v > ZZ_SMALL_MAX) {
+        return NULL;
     }
-    return ZZ_OK;
+    return &small_ints[v - ZZ_SMALL_MIN];
 }
 
 zz_err
-zz_sizeinbase(const zz_t *u, int base, size_t *len)
+zz_init(zz_t *u)
 {
-    const int abase = abs(base);
-
-    if (abase < 2 || abase > 36) {
-        return ZZ_VAL;
-    }
-    *len = mpn_sizeinbase(u->digits, u->size, abase);
+    SETNEG(false, u);
+    SETFLAGS(0, u);
+    SETALLOC(ZZ_INLINE_DIGITS, u);
+    u->size = 0;
+    u->digits = INLINE_DIGITS(u);
     return ZZ_OK;
 }
 
-zz_err
-zz_get_str(const zz_t *u, int base, char *str)
+/* Change capacity of u to (at least) alloc digits, preserving first
+   MIN(alloc, GETALLOC(u)) digits, like realloc().
+
+   Small integers use storage in the zz_t structure itself.  Once capacity
+   exceeds ZZ_INLINE_DIGITS, digits are moved to the heap.  Buffers of
+   moderate size are taken from the per-thread pool, huge buffers might be
+   mapped directly (see zz_set_mmap_threshold()).
+
+   Digits of arena-bound integers are extended in place, if they were the
+   last allocation from the arena.  Else, a new block is allocated and the
+   old one is abandoned until the arena reset.  Arena storage is never
+   shrunk. */
+static zz_err
+zz_realloc_digits(zz_t *u, zz_size_t alloc)
 {
-    /* Maps 1-byte integer to digit character for bases up to 36. */
-    const char *NUM_TO_TEXT = "0123456789abcdefghijklmnopqrstuvwxyz";
+    bool shared = ISSHARED(u);
+    zz_size_t keep = MIN(alloc, shared ? u->size : GETALLOC(u));
+    bool exact = zz_growth_policy(u) == ZZ_GROWTH_EXACT;
+    zz_digit_t *t;
+    bool mapped = false;
+
+    if (ISARENA(u)) {
+        if (alloc <= GETALLOC(u)) {
+            return ZZ_OK;
+        }
 
-    if (base < 0) {
-        base = -base;
-        NUM_TO_TEXT = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+        zz_arena_t *arena;
+
+        memcpy(&arena, u->digits - 1, sizeof(zz_arena_t *));
+        if (u->digits + GETALLOC(u) == arena->top
+            && arena->end - u->digits >= alloc)
+        {
+            t = u->digits;
+            arena->top = t + alloc;
+        }
+        else {
+            t = zz_arena_alloc(arena, alloc);
+            if (t) {
+                mpn_copyi(t, u->digits, keep);
+            }
+        }
     }
-    if (base < 2 || base > 36) {
-        return ZZ_VAL;
+    else if (zz_mmap_wanted(alloc)) {
+        t = zz_mmap_digits(ISMMAP(u) ? u->digits : NULL, GETALLOC(u), &alloc);
+        if (t && !ISMMAP(u)) {
+            mpn_copyi(t, u->digits, keep);
+            if (!ISINLINE(u)) {
+                (void)zz_heap_free(u->digits, GETALLOC(u));
+            }
+        }
+        mapped = true;
     }
-
-    unsigned char *p = (unsigned char *)str;
-    size_t len;
-
-    if (!u->size) {
-        *(p++) = '0';
-        goto end;
+    else if (ISMMAP(u)) {
+        if (alloc <= ZZ_INLINE_DIGITS) {
+            t = INLINE_DIGITS(u);
+            alloc = ZZ_INLINE_DIGITS;
+        }
+        else {
+            t = zz_heap_alloc(&alloc, exact);
+        }
+        if (t) {
+            mpn_copyi(t, u->digits, keep);
+            zz_munmap_digits(u->digits, GETALLOC(u));
+        }
     }
-    if (ISNEG(u)) {
-        *(p++) = '-';
+    else if (alloc <= ZZ_INLINE_DIGITS) {
+        if (!ISINLINE(u)) {
+            mpn_copyi(INLINE_DIGITS(u), u->digits, keep);
+            (void)zz_heap_free(u->digits, GETALLOC(u));
+        }
+        t = INLINE_DIGITS(u);
+        alloc = ZZ_INLINE_DIGITS;
     }
-    if ((base & (base - 1)) == 0) {
-        len = mpn_get_str(p, base, u->digits, u->size);
+    else if (ISINLINE(u) || shared || alloc <= zz_pool_limits.max_digits) {
+        t = zz_heap_alloc(&alloc, exact);
+        if (t) {
+            mpn_copyi(t, u->digits, keep);
+            if (!ISINLINE(u)) {
+                (void)zz_heap_free(u->digits, GETALLOC(u));
+            }
+        }
     }
-    else { /* generic base, not power of 2, input might be clobbered */
-        zz_digit_t *volatile tmp = malloc(ZZ_DIGIT_T_BYTES * (size_t)u->size);
-
-        if (!tmp || TMP_OVERFLOW) {
-            /* LCOV_EXCL_START */
-            free(tmp);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
+    else {
+        t = zz_state.realloc(u->digits - COW_HDR,
+                             (size_t)(GETALLOC(u) + COW_HDR)
+                             * ZZ_DIGIT_T_BYTES,
+                             (size_t)(alloc + COW_HDR) * ZZ_DIGIT_T_BYTES);
+        if (t) {
+            t += COW_HDR;
         }
-        mpn_copyi(tmp, u->digits, u->size);
-        len = mpn_get_str(p, base, tmp, u->size);
-        free(tmp);
     }
-    for (size_t i = 0; i < len; i++) {
-        *p = (unsigned char)NUM_TO_TEXT[*p];
-        p++;
+    /* Zero capacity (without inline digits) means no storage */
+    if (t || !alloc) {
+        /* Shared digits of u weren't freed */
+        if (t == INLINE_DIGITS(u)) {
+            if (!ISINLINE(u) && !shared) {
+                STATS_INC(frees, 1);
+                STATS_LIVE(-(int64_t)GETALLOC(u)*ZZ_DIGIT_T_BYTES);
+            }
+        }
+        else if (t != u->digits || alloc != GETALLOC(u)) {
+            bool fresh = ISINLINE(u) || shared;
+
+            if (fresh) {
+                STATS_INC(allocs, 1);
+            }
+            else {
+                STATS_INC(reallocs, 1);
+            }
+            STATS_INC(bytes, (uint64_t)alloc*ZZ_DIGIT_T_BYTES);
+            if (!ISARENA(u)) {
+                STATS_LIVE(((int64_t)alloc - (fresh ? 0 : GETALLOC(u)))
+                           *ZZ_DIGIT_T_BYTES);
+            }
+        }
+        u->digits = t;
+        SETALLOC(alloc, u);
+        SETFLAGS(mapped ? GETFLAGS(u) | ZZ_FLAG_MMAP
+                        : GETFLAGS(u) & ~ZZ_FLAG_MMAP, u);
+        return ZZ_OK;
     }
-end:
-    *p = '\0';
-    return ZZ_OK;
+    return ZZ_MEM; /* LCOV_EXCL_LINE */
 }
 
-/* Table of digit values for 8-bit string->mpz conversion.
-   Note that when converting a base B string, a char c is a legitimate
-   base B digit iff DIGIT_VALUE_TAB[c] < B. */
-const int DIGIT_VALUE_TAB[] =
-{
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1,-1,-1,-1,-1,-1,
-  -1,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,
-  25,26,27,28,29,30,31,32,33,34,35,-1,-1,-1,-1,-1,
-  -1,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,
-  25,26,27,28,29,30,31,32,33,34,35,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1,-1,-1,-1,-1,-1,
-  -1,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,
-  25,26,27,28,29,30,31,32,33,34,35,-1,-1,-1,-1,-1,
-  -1,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50,
-  51,52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-};
-
-zz_err
-zz_set_str(const char *str, int base, zz_t *u)
+/* Return capacity, that zz_realloc_digits() sets for u (which isn't
+   arena-bound and doesn't share digits) with the given alloc. */
+static zz_size_t
+zz_realloc_capacity(const zz_t *u, zz_size_t alloc)
 {
-    if (base && (base < 2 || base > 36)) {
-        return ZZ_VAL;
-    }
-
-    size_t len = strlen(str);
-    unsigned char *volatile buf = malloc(len), *p = (unsigned char *)buf;
+#if HAVE_SYS_MMAN_H
+    if (zz_mmap_wanted(alloc)) {
+        size_t bytes = zz_mmap_bytes(alloc);
 
-    if (!buf) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+        if (ISMMAP(u) && zz_mmap_bytes(GETALLOC(u)) == bytes) {
+            return GETALLOC(u);
+        }
+        return (zz_size_t)MIN(bytes/ZZ_DIGIT_T_BYTES, (size_t)ZZ_DIGITS_MAX);
     }
-    memcpy(buf, str, len);
-    while (len && isspace(*p)) {
-        p++;
-        len--;
+#endif
+    if (alloc <= ZZ_INLINE_DIGITS) {
+        return ZZ_INLINE_DIGITS;
     }
-    if (!len) {
-        goto err;
+    if (zz_growth_policy(u) == ZZ_GROWTH_EXACT) {
+        return alloc;
     }
+    return zz_pool_round(alloc + COW_HDR) - COW_HDR;
+}
 
-    bool negative = (p[0] == '-');
+/* Set size of u, allocating more space for digits if necessary.  Current
+   content of digits is preserved, like for realloc().  Capacity is never
+   reduced here, as callers may still read digits of u past the new size
+   (e.g. if u is also an input).
 
-    p += negative;
-    len -= negative;
-    if (!len) {
-        goto err;
-    }
-    if (!negative && p[0] == '+') {
-        p++;
-        len--;
-    }
-    if (!len || p[0] == '_') {
-        goto err;
-    }
-    if (p[0] == '0' && base == 0) {
-        if (len == 1) {
-            free(buf);
-            return zz_set_i64(0, u);
-        }
-        else if (tolower(p[1]) == 'b') {
-            base = 2;
-        }
-        else if (tolower(p[1]) == 'o') {
-            base = 8;
-        }
-        else if (tolower(p[1]) == 'x') {
-            base = 16;
-        }
-        else if (!isspace(p[1])) {
-            goto err;
-        }
-        p += 2;
-        len -= 2;
-        if (len && p[0] == '_') {
-            p++;
-            len--;
+   When growing, the new capacity is chosen according to the growth policy
+   of u.  The geometric policy increases capacity at least by 50%, so a
+   sequence of n increments does O(log(n)) reallocations.
+
+   Digits of u are written only after this call, so here shared digits are
+   replaced by the private copy. */
+static zz_err
+zz_resize(zz_size_t size, zz_t *u)
+{
+    if (GETALLOC(u) < size) {
+        if (zz_realloc_digits(u, zz_grow(u, size))) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
         }
     }
-    if (p[0] == '0' && len >= 2
-        && ((base == 2 && tolower(p[1]) == 'b')
-            || (base == 8 && tolower(p[1]) == 'o')
-            || (base == 16 && tolower(p[1]) == 'x')))
+    else if (ISSHARED(u)
+             && zz_realloc_digits(u, MAX(size, u->size)))
     {
-        p += 2;
-        len -= 2;
-    }
-    if (base == 0) {
-        base = 10;
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    if (!len || (len && p[0] == '_')) {
-        goto err;
+    u->size = size;
+    if (!u->size) {
+        SETNEG(false, u);
     }
+    return ZZ_OK;
+}
 
-    size_t new_len = len;
-
-    for (size_t i = 0; i < len; i++) {
-        if (p[i] == '_') {
-            if (i == len - 1 || p[i + 1] == '_') {
-                goto err;
-            }
-            new_len--;
-            memmove(p + i, p + i + 1, len - i - 1);
-        }
-
-        unsigned char c = (unsigned char)DIGIT_VALUE_TAB[p[i]];
-
-        if (c < base) {
-            p[i] = c;
-        }
-        else {
-            if (!isspace(p[i])) {
-                goto err;
-            }
-            new_len--;
-            for (size_t j = i + 1; j < len; j++) {
-                if (!isspace(p[j])) {
-                    goto err;
-                }
-                new_len--;
-            }
-            break;
-        }
+zz_err
+zz_reserve(zz_t *u, zz_size_t size)
+{
+    if (size < 0) {
+        return ZZ_VAL;
     }
-    len = new_len;
-    new_len = 1 + len/2;
-    if (new_len > ZZ_DIGITS_MAX) {
-        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    if (size > ZZ_DIGITS_MAX) {
+        return ZZ_BUF;
     }
-    if (zz_resize((zz_size_t)new_len, u) || TMP_OVERFLOW) {
-        /* LCOV_EXCL_START */
-        free(buf);
+    if (GETALLOC(u) < size && zz_realloc_digits(u, size)) {
         return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
     }
-    SETNEG(negative, u);
-    u->size = (zz_size_t)mpn_set_str(u->digits, p, len, base);
-    free(buf);
-    if (zz_resize(u->size, u)) {
+    return ZZ_OK;
+}
+
+zz_err
+zz_shrink_to_fit(zz_t *u)
+{
+    if (ISINLINE(u) || ISARENA(u) || ISSHARED(u)
+        || zz_realloc_capacity(u, u->size) == GETALLOC(u))
+    {
+        return ZZ_OK;
+    }
+    if (zz_realloc_digits(u, u->size)) {
         return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    zz_normalize(u);
     return ZZ_OK;
-err:
-    free(buf);
-    return ZZ_VAL;
 }
 
-static bool
-zz_tstbit(const zz_t *u, zz_bitcnt_t idx)
-{
-    zz_size_t digit_idx = (zz_size_t)(idx / ZZ_DIGIT_T_BITS);
+static unsigned int zz_trim_ratio = 0;
 
-    assert(u->size > digit_idx);
-    return (u->digits[digit_idx] >> (idx%ZZ_DIGIT_T_BITS)) & 1;
+void
+zz_set_trim_ratio(unsigned int ratio)
+{
+    zz_trim_ratio = ratio == 1 ? 2 : ratio;
 }
 
-zz_err
-zz_get_double(const zz_t *u, double *d)
+#define TRIM_MIN_DIGITS 64
+
+/* Reduce capacity of u, if it's much bigger than the size.  The new
+   capacity leaves some room for growth, so integers with fluctuating size
+   aren't trimmed and regrown back and forth.  It's checked against the
+   actual capacity (e.g. rounded up to the pool's size class), that must
+   pass the ratio test, else u would be trimmed on each assignment.  This is
+   an optimization: on failure, u is kept unchanged.
+
+   It's called on assignment, i.e. when the whole value of u was just
+   written.  Other functions may use digits past the size of their output
+   (e.g. after zz_normalize()), so trimming them isn't safe. */
+static void
+zz_trim(zz_t *u)
 {
-    if (u->size > DBL_MAX_EXP/ZZ_DIGIT_T_BITS + 1) {
-        *d = ISNEG(u) ? -INFINITY : INFINITY;
-        return ZZ_BUF;
-    }
-    if (!u->size) {
-        *d = 0.0;
-        return ZZ_OK;
-    }
+    if (zz_trim_ratio && GETALLOC(u) > TRIM_MIN_DIGITS
+        && GETALLOC(u)/zz_trim_ratio > u->size && !ISARENA(u)
+        && !ISSHARED(u))
+    {
+        zz_size_t alloc = u->size + u->size/2;
 
-    zz_bitcnt_t bits = zz_bitlen(u);
+        if ((int64_t)zz_realloc_capacity(u, alloc)/zz_trim_ratio > u->size) {
+            alloc = u->size;
+        }
 
-    /* round towards zero */
-    *d = mpn_get_d(u->digits, u->size, ISNEG(u) ? -1 : 1, 0L);
-    if (DBL_MANT_DIG < bits && bits <= DBL_MAX_EXP) {
-        bits -= DBL_MANT_DIG + 1;
-        if (zz_tstbit(u, bits)) {
-            zz_bitcnt_t tz = zz_lsbpos(u);
+        zz_size_t cap = zz_realloc_capacity(u, alloc);
 
-            if (tz < bits || (tz == bits && zz_tstbit(u, bits + 1))) {
-                *d = nextafter(*d, 2 * (*d)); /* round away from zero */
-            }
+        if (cap < GETALLOC(u) && (int64_t)cap/zz_trim_ratio <= u->size) {
+            (void)zz_realloc_digits(u, alloc);
         }
     }
-#if defined(__MINGW32__) && defined(__GNUC__)
-#  pragma GCC diagnostic push
-#  pragma GCC diagnostic ignored "-Wfloat-conversion"
-#endif
-    if (isinf(*d)) {
-#if defined(__MINGW32__) && defined(__GNUC__)
-#  pragma GCC diagnostic pop
-#endif
-        return ZZ_BUF;
-    }
-    return ZZ_OK;
 }
 
-zz_bitcnt_t
-zz_bitlen(const zz_t *u)
+/* Memory budget of the current thread in bytes, 0 means no limit. */
+static _Thread_local size_t zz_budget = 0;
+
+void
+zz_set_memory_budget(size_t bytes)
 {
-    return u->size ? (zz_bitcnt_t)mpn_sizeinbase(u->digits, u->size, 2) : 0;
+    zz_budget = bytes;
 }
 
-zz_bitcnt_t
-zz_lsbpos(const zz_t *u)
+/* Return true, if estimated peak memory usage of an operation (digits of
+   the result and temporary storage, including GMP's scratch space) exceeds
+   the memory budget.  Expensive functions check this before any
+   allocation. */
+static bool
+zz_over_budget(double digits)
 {
-#if ULONG_MAX == ZZ_DIGIT_T_MAX
-    return u->size ? mpn_scan1(u->digits, 0) : 0;
-#else
-    zz_bitcnt_t lsb_pos = 0;
+    return zz_budget && digits*ZZ_DIGIT_T_BYTES > (double)zz_budget;
+}
 
-    for (zz_size_t i = 0; i < u->size; i++) {
-        zz_digit_t digit = u->digits[i];
+/* Free storage of u (or drop the reference to shared digits) and set u to
+   zero.  Only the growth policy of u is kept. */
+static void
+zz_release(zz_t *u)
+{
+    if (!ISINLINE(u) && !ISARENA(u)) {
+        bool freed = true;
 
-        if (digit) {
-            for (;;) {
-                if (digit & 1) {
-                    return lsb_pos;
-                }
-                lsb_pos += 1;
-                digit >>= 1;
-            }
+        if (ISMMAP(u)) {
+            zz_munmap_digits(u->digits, GETALLOC(u));
         }
         else {
-            lsb_pos += 64;
+            freed = zz_heap_free(u->digits, GETALLOC(u));
+        }
+        if (freed) {
+            STATS_INC(frees, 1);
+            STATS_LIVE(-(int64_t)GETALLOC(u)*ZZ_DIGIT_T_BYTES);
         }
     }
-    return lsb_pos;
-#endif
+    SETNEG(false, u);
+    SETFLAGS(GETFLAGS(u) & ZZ_FLAG_GROWTH, u);
+    SETALLOC(ZZ_INLINE_DIGITS, u);
+    u->size = 0;
+    u->digits = INLINE_DIGITS(u);
 }
 
-zz_bitcnt_t
-zz_bitcnt(const zz_t *u)
+void
+zz_clear(zz_t *u)
 {
-#if ULONG_MAX == ZZ_DIGIT_T_MAX
-    return u->size ? mpn_popcount(u->digits, u->size) : 0;
-#else
-    zz_bitcnt_t count = 0;
-
-    for (zz_size_t i = 0; i < u->size; i++) {
-        zz_digit_t digit = u->digits[i];
-
-        while (digit) {
-            count += digit & 1;
-            digit >>= 1;
-        }
-    }
-    return count;
-#endif
+    zz_release(u);
+    SETFLAGS(0, u);
 }
 
-static const zz_layout native_layout = {
-    .bits_per_digit = ZZ_DIGIT_T_BITS,
-    .digit_size = sizeof(zz_digit_t),
-    .digits_order = -1,
-    .digit_endianness = 0,
-};
-
-const zz_layout *
-zz_get_layout(void)
+/* Make digits of u private, so they can be changed in place. */
+static zz_err
+zz_unshare(zz_t *u)
 {
-    return &native_layout;
+    return zz_resize(u->size, u);
 }
 
-zz_err
-zz_import(size_t len, const void *digits, zz_layout layout, zz_t *u)
+/* Copy value of u, which is also an output of the caller, to tmp.  In the
+   copy-on-write mode, digits are shared with tmp and then dropped by u (so
+   they aren't copied, when u is resized for the output).  Thus, u might
+   lose its value. */
+static zz_err
+zz_save(zz_t *u, zz_t *tmp)
 {
-    size_t size = (len*layout.bits_per_digit
-                   + (ZZ_DIGIT_T_BITS - 1))/ZZ_DIGIT_T_BITS;
-
-    if (len > SIZE_MAX / layout.bits_per_digit || size > INT_MAX) {
-        return ZZ_BUF; /* LCOV_EXCL_LINE */
-    }
-    if (zz_resize((zz_size_t)size, u)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    if (zz_init(tmp) || zz_pos(u, tmp)) {
+        /* LCOV_EXCL_START */
+        zz_clear(tmp);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
     }
-    if (layout.digit_size == 1 && layout.bits_per_digit == 8
-        && layout.digits_order == 1 && !layout.digit_endianness)
-    {
-        u->size = (zz_size_t)mpn_set_str(u->digits, digits, len, 256);
-        zz_normalize(u);
-        return ZZ_OK;
+    if (ISSHARED(u)) {
+        zz_release(u);
     }
-
-    assert(layout.digit_size*8 >= layout.bits_per_digit);
-    mpn_import(u->digits, (mp_size_t *)&u->size, len, layout.digits_order,
-               layout.digit_size, layout.digit_endianness,
-               (size_t)(layout.digit_size*8 - layout.bits_per_digit),
-               digits);
     return ZZ_OK;
 }
 
-zz_err
-zz_export(const zz_t *u, zz_layout layout, size_t len, void *digits)
+inline static void
+zz_normalize(zz_t *u)
 {
-    if (len < (zz_bitlen(u) + layout.bits_per_digit
-               - 1)/layout.bits_per_digit || u->size > INT_MAX)
-    {
-        return ZZ_BUF;
+    while (u->size && u->digits[u->size - 1] == 0) {
+        u->size--;
     }
-    if (layout.digit_size == 1 && layout.bits_per_digit == 8
-        && layout.digits_order == 1 && !layout.digit_endianness)
-    {
-        if (!u->size) {
-            memset(digits, 0, 1);
-        }
-        else {
-            mpn_get_str(digits, 256, u->digits, u->size);
-        }
-        return ZZ_OK;
+    if (!u->size) {
+        SETNEG(false, u);
     }
-
-    assert(layout.digit_size*8 >= layout.bits_per_digit);
-    mpn_export(digits, NULL, layout.digits_order, layout.digit_size,
-               layout.digit_endianness,
-               (size_t)(layout.digit_size*8 - layout.bits_per_digit),
-               u->digits, u->size);
-    return ZZ_OK;
 }
 
-static zz_err
-zz_addsub(const zz_t *u, const zz_t *v, bool subtract, zz_t *w)
+zz_ord
+zz_cmp(const zz_t *u, const zz_t *v)
 {
-    bool negu = ISNEG(u), negv = subtract ? !ISNEG(v) : ISNEG(v);
-    bool same_sign = negu == negv;
-    zz_size_t u_size = u->size, v_size = v->size;
-
-    if (!v_size) {
-        return zz_pos(u, w);
-    }
-    if (!u_size) {
-        return subtract ? zz_neg(v, w) : zz_pos(v, w);
-    }
-    if (u_size < v_size) {
-        SWAP(const zz_t *, u, v);
-        SWAP(bool, negu, negv);
-        SWAP(zz_size_t, u_size, v_size);
-    }
-    if (same_sign && u_size == ZZ_DIGITS_MAX) {
-        return ZZ_BUF; /* LCOV_EXCL_LINE */
-    }
-    if (zz_resize(u_size + same_sign, w)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
-    }
-    SETNEG(negu, w);
-    if (same_sign) {
-        if (!(w->digits[w->size - 1] = mpn_add(w->digits, u->digits, u_size,
-                                               v->digits, v_size)))
-        {
-            w->size--;
-        }
-        return ZZ_OK;
-    }
-    else if (u_size != v_size) {
-        mpn_sub(w->digits, u->digits, u_size, v->digits, v_size);
+    if (u == v) {
+        return ZZ_EQ;
     }
-    else {
-        int cmp = mpn_cmp(u->digits, v->digits, u_size);
 
-        if (cmp < 0) {
-            mpn_sub_n(w->digits, v->digits, u->digits, u_size);
-            SETNEG(negv, w);
-        }
-        else if (cmp > 0) {
-            mpn_sub_n(w->digits, u->digits, v->digits, u_size);
-        }
-        else {
-            SETNEG(false, w);
-            w->size = 0;
-            return ZZ_OK;
-        }
+    bool u_negative = ISNEG(u);
+    zz_ord res = u_negative ? ZZ_LT : ZZ_GT;
+
+    if (u_negative != ISNEG(v)) {
+        return res;
     }
-    zz_normalize(w);
-    return ZZ_OK;
+    else if (u->size != v->size) {
+        return (u->size < v->size) ? -res : res;
+    }
+    res = mpn_cmp(u->digits, v->digits, u->size);
+    return u_negative ? -res : res;
 }
 
-static zz_err
-zz_addsub_u64(const zz_t *u, uint64_t v, bool negv, zz_t *w)
+zz_ord
+zz_cmp_i64(const zz_t *u, int64_t v)
 {
-    bool negu = ISNEG(u), same_sign = negu == negv, v_size = v != 0;
-    zz_size_t u_size = u->size;
+    bool u_negative = ISNEG(u);
+    zz_ord res = u_negative ? ZZ_LT : ZZ_GT;
 
-    if (!u_size) {
-        if (v_size) {
-            if (zz_resize(v_size, w)) {
-                return ZZ_MEM; /* LCOV_EXCL_LINE */
-            }
-            w->digits[0] = v;
-            SETNEG(negv, w);
-        }
-        else {
-            w->size = 0;
-            SETNEG(false, w);
-        }
-        return ZZ_OK;
-    }
-    if (same_sign && u_size == ZZ_DIGITS_MAX) {
-        return ZZ_BUF; /* LCOV_EXCL_LINE */
-    }
-    if (zz_resize(u_size + same_sign, w)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
-    }
-    SETNEG(negu, w);
-    if (same_sign) {
-        if (!(w->digits[u_size] = mpn_add_1(w->digits, u->digits, u_size, v))) {
-            w->size--;
-        }
+    if (u_negative != (v < 0) || u->size > 1) {
+        return res;
     }
-    else if (u_size > 1) {
-        mpn_sub_1(w->digits, u->digits, u_size, v);
-        w->size -= w->digits[w->size - 1] == 0;
+    else if (!u->size) {
+        return v ? -res : ZZ_EQ;
     }
 
-    else {
-        if (u->digits[0] < v) {
-            w->digits[0] = v - u->digits[0];
-            SETNEG(negv, w);
-        }
-        else {
-            w->digits[0] = u->digits[0] - v;
-            if (!w->digits[0]) {
-                w->size = 0;
-                SETNEG(false, w);
-            }
-        }
+    zz_digit_t uu = u->digits[0], uv = ABS_CAST(zz_digit_t, v);
+
+    if (uu == uv) {
+        return ZZ_EQ;
     }
-    return ZZ_OK;
+    return uu > uv ? res : -res;
 }
 
 zz_err
-zz_addsub_i64(const zz_t *u, int64_t v, bool subtract, zz_t *w)
+zz_set_mpz_t(mpz_t u, zz_t *v)
 {
-    bool negv = v < 0;
-    uint64_t uv = ABS_CAST(uint64_t, v);
-
-    return zz_addsub_u64(u, uv, subtract ? !negv : negv, w);
+    if (zz_resize(abs(u->_mp_size), v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    mpn_copyi(v->digits, u->_mp_d, v->size);
+    SETNEG(u->_mp_size < 0, v);
+    return ZZ_OK;
 }
 
 zz_err
-zz_add(const zz_t *u, const zz_t *v, zz_t *w)
+zz_set_i32(int32_t u, zz_t *v)
 {
-    return zz_addsub(u, v, false, w);
-}
+    STATS_ENTER(ZZ_STATS_SET);
 
-zz_err
-zz_sub(const zz_t *u, const zz_t *v, zz_t *w)
-{
-    return zz_addsub(u, v, true, w);
+    if (!u) {
+        v->size = 0;
+        SETNEG(false, v);
+        zz_trim(v);
+        return ZZ_OK;
+    }
+    if (zz_resize(1, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(u < 0, v);
+    v->digits[0] = (zz_digit_t)abs(u);
+    zz_trim(v);
+    return ZZ_OK;
 }
 
 zz_err
-zz_add_u64(const zz_t *u, uint64_t v, zz_t *w)
+zz_set_i64(int64_t u, zz_t *v)
 {
-    return zz_addsub_u64(u, v, false, w);
-}
+    STATS_ENTER(ZZ_STATS_SET);
 
-zz_err
-zz_sub_u64(const zz_t *u, uint64_t v, zz_t *w)
-{
-    return zz_addsub_u64(u, v, true, w);
+    if (!u) {
+        v->size = 0;
+        SETNEG(false, v);
+        zz_trim(v);
+        return ZZ_OK;
+    }
+    if (zz_resize(1, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(u < 0, v);
+    v->digits[0] = ABS_CAST(zz_digit_t, u);
+    zz_trim(v);
+    return ZZ_OK;
 }
 
 zz_err
-zz_u64_sub(uint64_t u, const zz_t *v, zz_t *w)
+zz_set_u64(uint64_t u, zz_t *v)
 {
-    if (zz_neg(v, w)) {
+    STATS_ENTER(ZZ_STATS_SET);
+
+    if (!u) {
+        v->size = 0;
+        SETNEG(false, v);
+        zz_trim(v);
+        return ZZ_OK;
+    }
+    if (zz_resize(1, v)) {
         return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    return zz_addsub_u64(w, u, false, w);
+    SETNEG(false, v);
+    v->digits[0] = u;
+    zz_trim(v);
+    return ZZ_OK;
 }
 
+#define DIGITS_PER_DOUBLE ((53 + ZZ_DIGIT_T_BITS - 2) / ZZ_DIGIT_T_BITS + 1)
+
 zz_err
-zz_add_i64(const zz_t *u, int64_t v, zz_t *w)
+zz_set_double(double u, zz_t *v)
 {
-    return zz_addsub_i64(u, v, false, w);
-}
+    STATS_ENTER(ZZ_STATS_SET);
 
-zz_err
-zz_sub_i64(const zz_t *u, int64_t v, zz_t *w)
-{
-    return zz_addsub_i64(u, v, true, w);
-}
+#if defined(__MINGW32__) && defined(__GNUC__)
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wfloat-conversion"
+#endif
+    if (isnan(u)) {
+#if defined(__MINGW32__) && defined(__GNUC__)
+#  pragma GCC diagnostic pop
+#endif
+        return ZZ_VAL;
+    }
+#if defined(__MINGW32__) && defined(__GNUC__)
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wfloat-conversion"
+#endif
+    if (isinf(u)) {
+#if defined(__MINGW32__) && defined(__GNUC__)
+#  pragma GCC diagnostic pop
+#endif
+        return ZZ_BUF;
+    }
 
-zz_err
-zz_i64_sub(int64_t u, const zz_t *v, zz_t *w)
-{
-    if (zz_neg(v, w)) {
+    int exp;
+
+    (void)frexp(u, &exp);
+
+    zz_size_t size = exp > 0 ? (exp + ZZ_DIGIT_T_BITS - 1)/ZZ_DIGIT_T_BITS : 0;
+
+    if (zz_resize(MAX(size, DIGITS_PER_DOUBLE), v)) {
         return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    return zz_addsub_i64(w, u, false, w);
+
+    /* v has enough space to prevent new allocation by GMP */
+    TMP_MPZ(z, v);
+    mpz_set_d(z, u);
+    SETNEG(u < 0, v);
+    v->size = abs(z->_mp_size);
+    return ZZ_OK;
 }
 
 zz_err
-zz_mul(const zz_t *u, const zz_t *v, zz_t *w)
+zz_get_i32(const zz_t *u, int32_t *v)
 {
-    if (u->size < v->size) {
-        SWAP(const zz_t *, u, v);
-    }
-    if (v->size <= 1) {
-        bool w_negative = ISNEG(u) != ISNEG(v); /* in case v == w */
-        zz_err ret = zz_mul_u64(u, v->size ? v->digits[0] : 0, w);
+    zz_size_t n = u->size;
 
-        if (w->size) {
-            SETNEG(w_negative, w);
-        }
-        return ret;
+    if (!n) {
+        *v = 0;
+        return ZZ_OK;
+    }
+    if (n > 1) {
+        return ZZ_BUF;
     }
-    if (u == w) {
-        zz_t tmp;
-
-        if (zz_init(&tmp) || zz_pos(u, &tmp)) {
-            /* LCOV_EXCL_START */
-            zz_clear(&tmp);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
-        }
 
-        zz_err ret = u == v ? zz_mul(&tmp, &tmp, w) : zz_mul(&tmp, v, w);
+    zz_digit_t uv = u->digits[0];
 
-        zz_clear(&tmp);
-        return ret;
+    if (ISNEG(u)) {
+        if (uv <= INT32_MAX + (zz_digit_t)1) {
+            *v = -1 - (int32_t)((uv - 1) & INT32_MAX);
+            return ZZ_OK;
+        }
     }
-    if (v == w) {
-        zz_t tmp;
-
-        if (zz_init(&tmp) || zz_pos(v, &tmp)) {
-            /* LCOV_EXCL_START */
-            zz_clear(&tmp);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
+    else {
+        if (uv <= INT32_MAX) {
+            *v = (int32_t)uv;
+            return ZZ_OK;
         }
-
-        zz_err ret = zz_mul(u, &tmp, w);
-
-        zz_clear(&tmp);
-        return ret;
     }
+    return ZZ_BUF;
+}
 
-    uint64_t w_size = (uint64_t)u->size + (uint64_t)v->size;
+zz_err
+zz_get_i64(const zz_t *u, int64_t *v)
+{
+    zz_size_t n = u->size;
 
-    if (w_size > ZZ_DIGITS_MAX) {
-        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    if (!n) {
+        *v = 0;
+        return ZZ_OK;
     }
-    if (zz_resize((zz_size_t)w_size, w) || TMP_OVERFLOW) {
-        return ZZ_MEM;
+    if (n > 1) {
+        return ZZ_BUF;
     }
-    SETNEG(ISNEG(u) != ISNEG(v), w);
-    if (u->size == v->size) {
-        if (u != v) {
-            mpn_mul_n(w->digits, u->digits, v->digits, u->size);
-        }
-        else {
-            mpn_sqr(w->digits, u->digits, u->size);
+
+    zz_digit_t uv = u->digits[0];
+
+    if (ISNEG(u)) {
+        if (uv <= INT64_MAX + (zz_digit_t)1) {
+            *v = -1 - (int64_t)((uv - 1) & INT64_MAX);
+            return ZZ_OK;
         }
     }
     else {
-        mpn_mul(w->digits, u->digits, u->size, v->digits, v->size);
+        if (uv <= INT64_MAX) {
+            *v = (int64_t)uv;
+            return ZZ_OK;
+        }
     }
-    w->size -= w->digits[w->size - 1] == 0;
-    assert(w->size >= 1);
-    return ZZ_OK;
+    return ZZ_BUF;
 }
 
 zz_err
-zz_mul_u64(const zz_t *u, uint64_t v, zz_t *w)
+zz_get_u32(const zz_t *u, uint32_t *v)
 {
-    zz_size_t u_size = u->size;
-
-    if (!u_size || !v) {
-        return zz_set_i64(0, w);
+    if (ISNEG(u)) {
+        return ZZ_VAL;
     }
-    if (u_size == ZZ_DIGITS_MAX) {
-        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    if (!u->size) {
+        *v = 0;
+        return ZZ_OK;
     }
-    if (zz_resize(u_size + 1, w) || TMP_OVERFLOW) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    if (u->size > 1 || u->digits[0] > UINT32_MAX) {
+        return ZZ_BUF;
     }
-    SETNEG(ISNEG(u), w);
-    w->digits[u_size] = mpn_mul_1(w->digits, u->digits, u_size, v);
-    w->size -= w->digits[u_size] == 0;
-    assert(w->size >= 1);
+    *v = (uint32_t)u->digits[0];
     return ZZ_OK;
 }
 
 zz_err
-zz_mul_i64(const zz_t *u, int64_t v, zz_t *w)
+zz_get_u64(const zz_t *u, uint64_t *v)
 {
-    zz_err ret = zz_mul_u64(u, ABS_CAST(zz_digit_t, v), w);
-
-    if (w->size) {
-        SETNEG(ISNEG(u) != (v < 0), w);
+    if (ISNEG(u)) {
+        return ZZ_VAL;
     }
-    return ret;
+    if (u->size > 1) {
+        return ZZ_BUF;
+    }
+    *v = u->size ? u->digits[0] : 0;
+    return ZZ_OK;
 }
 
-zz_err
-zz_div(const zz_t *u, const zz_t *v, zz_t *q, zz_t *r)
+bool
+zz_iszero(const zz_t *u)
 {
-    if (!v->size) {
-        return ZZ_VAL;
-    }
-    if (!q || !r) {
-        if (!q && !r) {
-            return ZZ_OK;
-        }
-        if (!q) {
-            zz_t tmp;
-
-            if (zz_init(&tmp)) {
-                return ZZ_MEM; /* LCOV_EXCL_LINE */
-            }
+    return u->size == 0;
+}
 
-            zz_err ret = zz_div(u, v, &tmp, r);
+bool
+zz_isneg(const zz_t *u)
+{
+    return ISNEG(u);
+}
 
-            zz_clear(&tmp);
-            return ret;
-        }
-        else {
-            zz_t tmp;
+bool
+zz_isodd(const zz_t *u)
+{
+    return u->size && u->digits[0] & 1;
+}
 
-            if (zz_init(&tmp)) {
-                return ZZ_MEM; /* LCOV_EXCL_LINE */
-            }
+/* Smaller integers are copied even in the copy-on-write mode. */
+#define COW_MIN_DIGITS 8
 
-            zz_err ret = zz_div(u, v, q, &tmp);
+zz_err
+zz_pos(const zz_t *u, zz_t *v)
+{
+    STATS_ENTER(ZZ_STATS_SET);
 
-            zz_clear(&tmp);
-            return ret;
-        }
-    }
-    if (!u->size) {
-        if (zz_set_i64(0, q) || zz_set_i64(0, r)) {
-            goto err; /* LCOV_EXCL_LINE */
+    if (u != v) {
+        if (!u->size) {
+            return zz_set_i64(0, v);
         }
-    }
-    else if (u->size < v->size) {
-        if (ISNEG(u) != ISNEG(v)) {
-            if (zz_set_i64(-1, q) || zz_add(u, v, r)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
+#ifndef __STDC_NO_ATOMICS__
+        if (ISCOW(u) && u->size >= COW_MIN_DIGITS && !ISARENA(v)) {
+            atomic_fetch_add_explicit(REFCNT(u->digits), 1,
+                                      memory_order_relaxed);
+            zz_release(v);
+            SETNEG(ISNEG(u), v);
+            SETALLOC(GETALLOC(u), v);
+            v->size = u->size;
+            v->digits = u->digits;
+            return ZZ_OK;
         }
-        else {
-            if (zz_set_i64(0, q) || zz_pos(u, r)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
+#endif
+        if (zz_resize(u->size, v)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
         }
+        SETNEG(ISNEG(u), v);
+        mpn_copyi(v->digits, u->digits, u->size);
+        zz_trim(v);
     }
-    else {
-        if (u == q || u == r) {
-            zz_t tmp;
-
-            if (zz_init(&tmp) || zz_pos(u, &tmp)) {
-                /* LCOV_EXCL_START */
-                zz_clear(&tmp);
-                return ZZ_MEM;
-                /* LCOV_EXCL_STOP */
-            }
+    return ZZ_OK;
+}
 
-            zz_err ret = zz_div(&tmp, v, q, r);
+zz_err
+zz_abs(const zz_t *u, zz_t *v)
+{
+    STATS_ENTER(ZZ_STATS_SET);
 
-            zz_clear(&tmp);
-            return ret;
-        }
-        if (v == q || v == r) {
-            zz_t tmp;
+    if (u != v && zz_pos(u, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(false, v);
+    return ZZ_OK;
+}
 
-            if (zz_init(&tmp) || zz_pos(v, &tmp)) {
-                /* LCOV_EXCL_START */
-                zz_clear(&tmp);
-                return ZZ_MEM;
-                /* LCOV_EXCL_STOP */
-            }
+zz_err
+zz_neg(const zz_t *u, zz_t *v)
+{
+    STATS_ENTER(ZZ_STATS_SET);
 
-            zz_err ret = zz_div(u, &tmp, q, r);
+    if (u != v && zz_pos(u, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    if (v->size) {
+        SETNEG(!ISNEG(u), v);
+    }
+    return ZZ_OK;
+}
 
-            zz_clear(&tmp);
-            return ret;
-        }
-
-        zz_size_t u_size = u->size;
+zz_err
+zz_sizeinbase(const zz_t *u, int base, size_t *len)
+{
+    const int abase = abs(base);
 
-        if (zz_resize(u_size - v->size + 1, q)
-            || zz_resize(v->size, r) || TMP_OVERFLOW)
-        {
-            goto err; /* LCOV_EXCL_LINE */
-        }
-        SETNEG(ISNEG(u) != ISNEG(v), q);
-        SETNEG(ISNEG(v), r);
-        mpn_tdiv_qr(q->digits, r->digits, 0, u->digits, u_size, v->digits,
-                    v->size);
-        q->size -= q->digits[q->size - 1] == 0;
-        zz_normalize(r);
-        if (ISNEG(q) && r->size) {
-            /* Note that we can't get carry here for q of maximal size,
-               as this would mean |v| == 1, thus: r == 0 */
-            assert(q->size < ZZ_DIGITS_MAX);
-            if (zz_sub_i64(q, 1, q)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            r->size = v->size;
-            mpn_sub_n(r->digits, v->digits, r->digits, v->size);
-            zz_normalize(r);
-        }
+    if (abase < 2 || abase > 36) {
+        return ZZ_VAL;
     }
+    *len = mpn_sizeinbase(u->digits, u->size, abase);
     return ZZ_OK;
-    /* LCOV_EXCL_START */
-err:
-    zz_clear(q);
-    zz_clear(r);
-    return ZZ_MEM;
-    /* LCOV_EXCL_STOP */
 }
 
 zz_err
-zz_div_i64(const zz_t *u, int64_t v, zz_t *q, zz_t *r)
+zz_get_str(const zz_t *u, int base, char *str)
 {
-    if (!v) {
+    STATS_ENTER(ZZ_STATS_GET_STR);
+
+    /* Maps 1-byte integer to digit character for bases up to 36. */
+    const char *NUM_TO_TEXT = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+    if (base < 0) {
+        base = -base;
+        NUM_TO_TEXT = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    }
+    if (base < 2 || base > 36) {
         return ZZ_VAL;
     }
 
-    zz_digit_t rl, uv = ABS_CAST(zz_digit_t, v);
-    bool same_signs = ISNEG(u) == (v < 0);
+    unsigned char *p = (unsigned char *)str;
+    size_t len;
 
-    if (q) {
-        if (u->size) {
-            if (zz_resize(u->size, q)) {
-                return ZZ_MEM; /* LCOV_EXCL_LINE */
-            }
-            rl = mpn_divrem_1(q->digits, 0, u->digits, u->size, uv);
-            if (rl && !same_signs) {
-                mpn_add_1(q->digits, q->digits, q->size, 1);
-            }
-            q->size -= q->digits[q->size - 1] == 0;
-            SETNEG(q->size ? !same_signs : false, q);
-        }
-        else {
-            (void)zz_set_i32(0, q);
-        }
+    if (!u->size) {
+        *(p++) = '0';
+        goto end;
     }
-    if (r) {
-        if (!u->size) {
-            return zz_set_i32(0, r);
-        }
-
-        zz_size_t u_size = u->size;
+    if (ISNEG(u)) {
+        *(p++) = '-';
+    }
+    if ((base & (base - 1)) == 0) {
+        len = mpn_get_str(p, base, u->digits, u->size);
+    }
+    else { /* generic base, not power of 2, input might be clobbered */
+        zz_digit_t *volatile tmp = TMP_ALLOC(ZZ_DIGIT_T_BYTES
+                                             * (size_t)u->size);
 
-        if (zz_resize(1, r)) {
-            return ZZ_MEM; /* LCOV_EXCL_LINE */
-        }
-        rl = mpn_mod_1(u->digits, u_size, uv);
-        if (!rl) {
-            (void)zz_set_i32(0, r);
-        }
-        else {
-            if (!same_signs) {
-                rl = uv - rl;
-            }
-            r->digits[0] = rl;
-            SETNEG(v < 0, r);
+        if (!tmp || TMP_OVERFLOW) {
+            /* LCOV_EXCL_START */
+            TMP_FREE(tmp);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
         }
-        return ZZ_OK;
+        mpn_copyi(tmp, u->digits, u->size);
+        len = mpn_get_str(p, base, tmp, u->size);
+        TMP_FREE(tmp);
+    }
+    for (size_t i = 0; i < len; i++) {
+        *p = (unsigned char)NUM_TO_TEXT[*p];
+        p++;
     }
+end:
+    *p = '\0';
     return ZZ_OK;
 }
 
-static int64_t
-fdiv_r(int64_t a, int64_t b)
+/* Table of digit values for 8-bit string->mpz conversion.
+   Note that when converting a base B string, a char c is a legitimate
+   base B digit iff DIGIT_VALUE_TAB[c] < B. */
+const int DIGIT_VALUE_TAB[] =
 {
-    return a/b - (a%b != 0 && (a^b) < 0);
-}
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1,-1,-1,-1,-1,-1,
+  -1,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,
+  25,26,27,28,29,30,31,32,33,34,35,-1,-1,-1,-1,-1,
+  -1,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,
+  25,26,27,28,29,30,31,32,33,34,35,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1,-1,-1,-1,-1,-1,
+  -1,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,
+  25,26,27,28,29,30,31,32,33,34,35,-1,-1,-1,-1,-1,
+  -1,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50,
+  51,52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+};
 
-zz_err
-zz_i64_div(int64_t u, const zz_t *v, zz_t *q, zz_t *r)
+/* Convert len digit values in the given base (not a power of 2) to rp, by
+   chunks, fitting in one digit.  Quadratic in len, but doesn't allocate
+   memory, unlike mpn_set_str().  Return the number of written digits. */
+#define SET_STR_BASECASE_MAX 400
+
+static zz_size_t
+zz_set_str_basecase(zz_digit_t *rp, const unsigned char *str, size_t len,
+                    int base)
 {
-    if (!v->size) {
-        return ZZ_VAL;
+    size_t chunk = 1;
+    zz_digit_t big_base = (zz_digit_t)base;
+
+    while (big_base <= ZZ_DIGIT_T_MAX / (zz_digit_t)base) {
+        big_base *= (zz_digit_t)base;
+        chunk++;
     }
 
-    int64_t sv;
+    zz_size_t size = 0;
+    size_t k = len % chunk ? len % chunk : chunk;
 
-    if (q) {
-        zz_err ret = ZZ_OK;
+    for (size_t i = 0; i < len; i += k, k = chunk) {
+        zz_digit_t c = 0, m = 1;
 
-        if (zz_get_i64(v, &sv)) {
-            ret = zz_set_i64((u < 0) == ISNEG(v) || !u ? 0 : -1, q);
-        }
-        else {
-            ret = zz_set_i64(fdiv_r(u, sv), q);
-        }
-        if (ret || !r) {
-            return ret; /* LCOV_EXCL_LINE */
+        for (size_t j = 0; j < k; j++) {
+            c = c*(zz_digit_t)base + str[i + j];
+            m *= (zz_digit_t)base;
         }
-    }
-    if (r) {
-        if (zz_get_i64(v, &sv)) {
-            if ((u < 0) == ISNEG(v) || !u) {
-                return zz_set_i64(u, r);
+        if (size) {
+            zz_digit_t cy = mpn_mul_1(rp, rp, size, m);
+
+            cy += mpn_add_1(rp, rp, size, c);
+            if (cy) {
+                rp[size++] = cy;
             }
-            return zz_add_i64(v, u, r);
         }
-        return zz_set_i64(u - fdiv_r(u, sv)*sv, r);
+        else if (c) {
+            rp[size++] = c;
+        }
     }
-    return ZZ_OK;
+    return size;
 }
 
 zz_err
-zz_quo_2exp(const zz_t *u, zz_bitcnt_t shift, zz_t *v)
+zz_set_str(const char *str, int base, zz_t *u)
 {
-    if (!u->size) {
-        return zz_set_i32(0, v);
-    }
-    if (shift >= (zz_bitcnt_t)u->size*ZZ_DIGIT_T_BITS) {
-        return zz_set_i64(ISNEG(u) ? -1 : 0, v);
+    STATS_ENTER(ZZ_STATS_SET);
+
+    if (base && (base < 2 || base > 36)) {
+        return ZZ_VAL;
     }
 
-    zz_size_t whole = (zz_size_t)(shift / ZZ_DIGIT_T_BITS);
-    zz_size_t size = u->size - whole;
-    bool carry = false, extra = true;
+    size_t len = strlen(str);
+    unsigned char *volatile buf = TMP_ALLOC(len), *p = (unsigned char *)buf;
 
-    shift %= ZZ_DIGIT_T_BITS;
-    for (mp_size_t i = 0; i < whole; i++) {
-        if (u->digits[i]) {
-            carry = ISNEG(u);
-            break;
-        }
-    }
-    for (mp_size_t i = whole; i < u->size; i++) {
-        if (u->digits[i] != ZZ_DIGIT_T_MAX) {
-            extra = 0;
-            break;
-        }
-    }
-    if (zz_resize(size + extra, v)) {
+    if (!buf) {
         return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    SETNEG(ISNEG(u), v);
-    if (shift) {
-        if (mpn_rshift(v->digits, u->digits + whole, size,
-                       (unsigned int)shift))
-        {
-            carry = ISNEG(u);
-        }
-    }
-    else {
-        mpn_copyi(v->digits, u->digits + whole, size);
-    }
-    if (extra) {
-        v->digits[size] = 0;
-    }
-    if (carry) {
-        if (mpn_add_1(v->digits, v->digits, size, 1)) {
-            v->digits[size] = 1;
-        }
-    }
-    zz_normalize(v);
-    return ZZ_OK;
-}
-
-zz_err
-zz_mul_2exp(const zz_t *u, zz_bitcnt_t shift, zz_t *v)
-{
-    if (!u->size) {
-        return zz_set_i32(0, v);
+    memcpy(buf, str, len);
+    while (len && isspace(*p)) {
+        p++;
+        len--;
     }
-    if (shift > ZZ_BITS_MAX) {
-        return ZZ_BUF;
+    if (!len) {
+        goto err;
     }
 
-    zz_size_t whole = (zz_size_t)(shift / ZZ_DIGIT_T_BITS);
-    zz_size_t u_size = u->size;
-    int64_t v_size = (int64_t)u_size + whole;
+    bool negative = (p[0] == '-');
 
-    shift %= ZZ_DIGIT_T_BITS;
-    v_size += (bool)shift;
-    if (v_size > ZZ_DIGITS_MAX) {
-        return ZZ_BUF;
+    p += negative;
+    len -= negative;
+    if (!len) {
+        goto err;
     }
-    if (zz_resize((zz_size_t)v_size, v)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    if (!negative && p[0] == '+') {
+        p++;
+        len--;
     }
-    SETNEG(ISNEG(u), v);
-    if (shift) {
-        v->size -= !(bool)(v->digits[v->size - 1]
-                           = mpn_lshift(v->digits + whole,
-                                        u->digits, u_size,
-                                        (unsigned int)shift));
+    if (!len || p[0] == '_') {
+        goto err;
     }
-    else {
-        mpn_copyd(v->digits + whole, u->digits, u_size);
-    }
-    mpn_zero(v->digits, whole);
-    return ZZ_OK;
-}
-
-zz_err
-zz_invert(const zz_t *u, zz_t *v)
-{
-    zz_size_t u_size = u->size;
-
-    if (ISNEG(u)) {
-        if (zz_resize(u_size, v)) {
-            return ZZ_MEM; /* LCOV_EXCL_LINE */
+    if (p[0] == '0' && base == 0) {
+        if (len == 1) {
+            TMP_FREE(buf);
+            return zz_set_i64(0, u);
         }
-        mpn_sub_1(v->digits, u->digits, u_size, 1);
-        v->size -= v->digits[u_size - 1] == 0;
-    }
-    else if (!u_size) {
-        return zz_set_i64(-1, v);
-    }
-    else {
-        if (u_size == ZZ_DIGITS_MAX) {
-            return ZZ_BUF; /* LCOV_EXCL_LINE */
+        else if (tolower(p[1]) == 'b') {
+            base = 2;
         }
-        if (zz_resize(u_size + 1, v)) {
-            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        else if (tolower(p[1]) == 'o') {
+            base = 8;
+        }
+        else if (tolower(p[1]) == 'x') {
+            base = 16;
+        }
+        else if (!isspace(p[1])) {
+            goto err;
+        }
+        p += 2;
+        len -= 2;
+        if (len && p[0] == '_') {
+            p++;
+            len--;
         }
-        v->digits[u_size] = mpn_add_1(v->digits, u->digits, u_size, 1);
-        v->size -= v->digits[u_size] == 0;
     }
-    SETNEG(!ISNEG(u), v);
-    return ZZ_OK;
-}
-
-zz_err
-zz_and(const zz_t *u, const zz_t *v, zz_t *w)
-{
-    if (!u->size || !v->size) {
-        return zz_set_i64(0, w);
+    if (p[0] == '0' && len >= 2
+        && ((base == 2 && tolower(p[1]) == 'b')
+            || (base == 8 && tolower(p[1]) == 'o')
+            || (base == 16 && tolower(p[1]) == 'x')))
+    {
+        p += 2;
+        len -= 2;
+    }
+    if (base == 0) {
+        base = 10;
+    }
+    if (!len || (len && p[0] == '_')) {
+        goto err;
     }
 
-    zz_size_t u_size = u->size, v_size = v->size;
-
-    if (ISNEG(u) || ISNEG(v)) {
-        zz_t o1, o2;
-        zz_err ret = ZZ_MEM;
+    size_t new_len = len;
 
-        if (zz_init(&o1) || zz_init(&o2)) {
-            /* LCOV_EXCL_START */
-err:
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ret;
-            /* LCOV_EXCL_STOP */
-        }
-        if (ISNEG(u)) {
-            ret = zz_invert(u, &o1);
-            if (ret) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, &o1);
-            u = &o1;
-            u_size = u->size;
-        }
-        if (ISNEG(v)) {
-            ret = zz_invert(v, &o2);
-            if (ret) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, &o2);
-            v = &o2;
-            v_size = v->size;
-        }
-        if (u_size < v_size) {
-            SWAP(const zz_t *, u, v);
-            SWAP(zz_size_t, u_size, v_size);
-        }
-        if (ISNEG(u) && ISNEG(v)) {
-            if (!u_size) {
-                zz_clear(&o1);
-                zz_clear(&o2);
-                return zz_set_i64(-1, w);
-            }
-            if (u_size == ZZ_DIGITS_MAX) {
-                return ZZ_BUF; /* LCOV_EXCL_LINE */
-            }
-            if (zz_resize(u_size + 1, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, w);
-            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
-            if (v_size) {
-                mpn_ior_n(w->digits, u->digits, v->digits, v_size);
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] == '_') {
+            if (i == len - 1 || p[i + 1] == '_') {
+                goto err;
             }
-            w->digits[u_size] = mpn_add_1(w->digits, w->digits, u_size, 1);
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
+            new_len--;
+            memmove(p + i, p + i + 1, len - i - 1);
         }
-        else if (ISNEG(u)) {
-            assert(v_size > 0);
-            if (zz_resize(v_size, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(false, w);
-            mpn_andn_n(w->digits, v->digits, u->digits, v_size);
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
+
+        unsigned char c = (unsigned char)DIGIT_VALUE_TAB[p[i]];
+
+        if (c < base) {
+            p[i] = c;
         }
         else {
-            assert(u_size > 0);
-            if (zz_resize(u_size, w)) {
-                goto err; /* LCOV_EXCL_LINE */
+            if (!isspace(p[i])) {
+                goto err;
             }
-            SETNEG(false, w);
-            if (v_size) {
-                mpn_andn_n(w->digits, u->digits, v->digits, v_size);
+            new_len--;
+            for (size_t j = i + 1; j < len; j++) {
+                if (!isspace(p[j])) {
+                    goto err;
+                }
+                new_len--;
             }
-            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
+            break;
         }
     }
-    if (u_size < v_size) {
-        SWAP(const zz_t *, u, v);
-        SWAP(zz_size_t, u_size, v_size);
+    len = new_len;
+    new_len = 1 + len/2;
+    if (new_len > ZZ_DIGITS_MAX) {
+        /* LCOV_EXCL_START */
+        TMP_FREE(buf);
+        return ZZ_BUF;
+        /* LCOV_EXCL_STOP */
     }
-    SETNEG(false, w);
-    for (zz_size_t i = v_size; --i >= 0;) {
-        if (u->digits[i] & v->digits[i]) {
-            v_size = i + 1;
-            if (zz_resize(v_size, w)) {
-                return ZZ_MEM; /* LCOV_EXCL_LINE */
-            }
-            mpn_and_n(w->digits, u->digits, v->digits, v_size);
-            zz_normalize(w);
-            return ZZ_OK;
+    if (zz_resize((zz_size_t)new_len, u)) {
+        /* LCOV_EXCL_START */
+        TMP_FREE(buf);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    SETNEG(negative, u);
+    /* mpn_set_str() doesn't allocate memory for power of 2 bases */
+    if ((base & (base - 1)) == 0) {
+        u->size = (zz_size_t)mpn_set_str(u->digits, p, len, base);
+    }
+    else if (len <= SET_STR_BASECASE_MAX) {
+        u->size = zz_set_str_basecase(u->digits, p, len, base);
+    }
+    else {
+        if (TMP_OVERFLOW) {
+            /* LCOV_EXCL_START */
+            TMP_FREE(buf);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
         }
+        u->size = (zz_size_t)mpn_set_str(u->digits, p, len, base);
     }
-    w->size = 0;
+    TMP_FREE(buf);
+    if (zz_resize(u->size, u)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    zz_normalize(u);
     return ZZ_OK;
+err:
+    TMP_FREE(buf);
+    return ZZ_VAL;
+}
+
+static bool
+zz_tstbit(const zz_t *u, zz_bitcnt_t idx)
+{
+    zz_size_t digit_idx = (zz_size_t)(idx / ZZ_DIGIT_T_BITS);
+
+    assert(u->size > digit_idx);
+    return (u->digits[digit_idx] >> (idx%ZZ_DIGIT_T_BITS)) & 1;
 }
 
 zz_err
-zz_or(const zz_t *u, const zz_t *v, zz_t *w)
+zz_get_double(const zz_t *u, double *d)
 {
-    if (!u->size) {
-        return zz_pos(v, w);
+    if (u->size > DBL_MAX_EXP/ZZ_DIGIT_T_BITS + 1) {
+        *d = ISNEG(u) ? -INFINITY : INFINITY;
+        return ZZ_BUF;
     }
-    if (!v->size) {
-        return zz_pos(u, w);
+    if (!u->size) {
+        *d = 0.0;
+        return ZZ_OK;
     }
 
-    zz_size_t u_size = u->size, v_size = v->size;
+    zz_bitcnt_t bits = zz_bitlen(u);
 
-    if (ISNEG(u) || ISNEG(v)) {
-        zz_t o1, o2;
-        zz_err ret = ZZ_MEM;
+    /* round towards zero */
+    *d = mpn_get_d(u->digits, u->size, ISNEG(u) ? -1 : 1, 0L);
+    if (DBL_MANT_DIG < bits && bits <= DBL_MAX_EXP) {
+        bits -= DBL_MANT_DIG + 1;
+        if (zz_tstbit(u, bits)) {
+            zz_bitcnt_t tz = zz_lsbpos(u);
 
-        if (zz_init(&o1) || zz_init(&o2)) {
-            /* LCOV_EXCL_START */
-err:
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ret;
-            /* LCOV_EXCL_STOP */
-        }
-        if (ISNEG(u)) {
-            ret = zz_invert(u, &o1);
-            if (ret) {
-                goto err; /* LCOV_EXCL_LINE */
+            if (tz < bits || (tz == bits && zz_tstbit(u, bits + 1))) {
+                *d = nextafter(*d, 2 * (*d)); /* round away from zero */
             }
-            SETNEG(true, &o1);
-            u = &o1;
-            u_size = u->size;
         }
-        if (ISNEG(v)) {
-            ret = zz_invert(v, &o2);
-            if (ret) {
-                goto err; /* LCOV_EXCL_LINE */
+    }
+#if defined(__MINGW32__) && defined(__GNUC__)
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wfloat-conversion"
+#endif
+    if (isinf(*d)) {
+#if defined(__MINGW32__) && defined(__GNUC__)
+#  pragma GCC diagnostic pop
+#endif
+        return ZZ_BUF;
+    }
+    return ZZ_OK;
+}
+
+zz_bitcnt_t
+zz_bitlen(const zz_t *u)
+{
+    return u->size ? (zz_bitcnt_t)mpn_sizeinbase(u->digits, u->size, 2) : 0;
+}
+
+zz_bitcnt_t
+zz_lsbpos(const zz_t *u)
+{
+#if ULONG_MAX == ZZ_DIGIT_T_MAX
+    return u->size ? mpn_scan1(u->digits, 0) : 0;
+#else
+    zz_bitcnt_t lsb_pos = 0;
+
+    for (zz_size_t i = 0; i < u->size; i++) {
+        zz_digit_t digit = u->digits[i];
+
+        if (digit) {
+            for (;;) {
+                if (digit & 1) {
+                    return lsb_pos;
+                }
+                lsb_pos += 1;
+                digit >>= 1;
             }
-            SETNEG(true, &o2);
-            v = &o2;
-            v_size = v->size;
         }
-        if (u_size < v_size) {
-            SWAP(const zz_t *, u, v);
-            SWAP(zz_size_t, u_size, v_size);
+        else {
+            lsb_pos += 64;
         }
-        if (ISNEG(u) && ISNEG(v)) {
-            if (!v_size) {
-                zz_clear(&o1);
-                zz_clear(&o2);
-                return zz_set_i64(-1, w);
-            }
-            if (v_size == ZZ_DIGITS_MAX) {
-                return ZZ_BUF; /* LCOV_EXCL_LINE */
-            }
-            if (zz_resize(v_size + 1, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, w);
-            mpn_and_n(w->digits, u->digits, v->digits, v_size);
-            w->digits[v_size] = mpn_add_1(w->digits, w->digits, v_size, 1);
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
+    }
+    return lsb_pos;
+#endif
+}
+
+zz_bitcnt_t
+zz_bitcnt(const zz_t *u)
+{
+#if ULONG_MAX == ZZ_DIGIT_T_MAX
+    return u->size ? mpn_popcount(u->digits, u->size) : 0;
+#else
+    zz_bitcnt_t count = 0;
+
+    for (zz_size_t i = 0; i < u->size; i++) {
+        zz_digit_t digit = u->digits[i];
+
+        while (digit) {
+            count += digit & 1;
+            digit >>= 1;
         }
-        else if (ISNEG(u)) {
-            assert(v_size > 0);
-            if (u_size == ZZ_DIGITS_MAX) {
-                return ZZ_BUF; /* LCOV_EXCL_LINE */
-            }
-            if (zz_resize(u_size + 1, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, w);
-            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
-            mpn_andn_n(w->digits, u->digits, v->digits, v_size);
-            w->digits[u_size] = mpn_add_1(w->digits, w->digits, u_size, 1);
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
+    }
+    return count;
+#endif
+}
+
+static const zz_layout native_layout = {
+    .bits_per_digit = ZZ_DIGIT_T_BITS,
+    .digit_size = sizeof(zz_digit_t),
+    .digits_order = -1,
+    .digit_endianness = 0,
+};
+
+const zz_layout *
+zz_get_layout(void)
+{
+    return &native_layout;
+}
+
+zz_err
+zz_import(size_t len, const void *digits, zz_layout layout, zz_t *u)
+{
+    STATS_ENTER(ZZ_STATS_SET);
+
+    size_t size = (len*layout.bits_per_digit
+                   + (ZZ_DIGIT_T_BITS - 1))/ZZ_DIGIT_T_BITS;
+
+    if (len > SIZE_MAX / layout.bits_per_digit || size > INT_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    if (zz_resize((zz_size_t)size, u)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    if (layout.digit_size == 1 && layout.bits_per_digit == 8
+        && layout.digits_order == 1 && !layout.digit_endianness)
+    {
+        u->size = (zz_size_t)mpn_set_str(u->digits, digits, len, 256);
+        zz_normalize(u);
+        return ZZ_OK;
+    }
+
+    assert(layout.digit_size*8 >= layout.bits_per_digit);
+
+    mp_size_t rn;
+
+    mpn_import(u->digits, &rn, len, layout.digits_order,
+               layout.digit_size, layout.digit_endianness,
+               (size_t)(layout.digit_size*8 - layout.bits_per_digit),
+               digits);
+    u->size = (zz_size_t)rn;
+    return ZZ_OK;
+}
+
+zz_err
+zz_export(const zz_t *u, zz_layout layout, size_t len, void *digits)
+{
+    if (len < (zz_bitlen(u) + layout.bits_per_digit
+               - 1)/layout.bits_per_digit || u->size > INT_MAX)
+    {
+        return ZZ_BUF;
+    }
+    if (layout.digit_size == 1 && layout.bits_per_digit == 8
+        && layout.digits_order == 1 && !layout.digit_endianness)
+    {
+        if (!u->size) {
+            memset(digits, 0, 1);
         }
         else {
-            assert(u_size > 0);
-            if (v_size == ZZ_DIGITS_MAX) {
-                return ZZ_BUF; /* LCOV_EXCL_LINE */
-            }
-            if (zz_resize(v_size + 1, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, w);
-            if (v_size) {
-                mpn_andn_n(w->digits, v->digits, u->digits, v_size);
-                w->digits[v_size] = mpn_add_1(w->digits, w->digits, v_size, 1);
-                zz_normalize(w);
-            }
-            else {
-                w->digits[0] = 1;
-            }
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
+            mpn_get_str(digits, 256, u->digits, u->size);
         }
+        return ZZ_OK;
+    }
+
+    assert(layout.digit_size*8 >= layout.bits_per_digit);
+    mpn_export(digits, NULL, layout.digits_order, layout.digit_size,
+               layout.digit_endianness,
+               (size_t)(layout.digit_size*8 - layout.bits_per_digit),
+               u->digits, u->size);
+    return ZZ_OK;
+}
+
+static zz_err
+zz_addsub(const zz_t *u, const zz_t *v, bool subtract, zz_t *w)
+{
+    bool negu = ISNEG(u), negv = subtract ? !ISNEG(v) : ISNEG(v);
+    bool same_sign = negu == negv;
+    zz_size_t u_size = u->size, v_size = v->size;
+
+    if (!v_size) {
+        return zz_pos(u, w);
+    }
+    if (!u_size) {
+        return subtract ? zz_neg(v, w) : zz_pos(v, w);
     }
     if (u_size < v_size) {
         SWAP(const zz_t *, u, v);
+        SWAP(bool, negu, negv);
         SWAP(zz_size_t, u_size, v_size);
     }
-    if (zz_resize(u_size, w)) {
+    if (same_sign && u_size == ZZ_DIGITS_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    if (zz_resize(u_size + same_sign, w)) {
         return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    SETNEG(false, w);
-    mpn_ior_n(w->digits, u->digits, v->digits, v_size);
-    if (u_size != v_size) {
-        mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
+    SETNEG(negu, w);
+    if (same_sign) {
+        if (!(w->digits[w->size - 1] = mpn_add(w->digits, u->digits, u_size,
+                                               v->digits, v_size)))
+        {
+            w->size--;
+        }
+        return ZZ_OK;
+    }
+    else if (u_size != v_size) {
+        mpn_sub(w->digits, u->digits, u_size, v->digits, v_size);
+    }
+    else {
+        int cmp = mpn_cmp(u->digits, v->digits, u_size);
+
+        if (cmp < 0) {
+            mpn_sub_n(w->digits, v->digits, u->digits, u_size);
+            SETNEG(negv, w);
+        }
+        else if (cmp > 0) {
+            mpn_sub_n(w->digits, u->digits, v->digits, u_size);
+        }
+        else {
+            SETNEG(false, w);
+            w->size = 0;
+            return ZZ_OK;
+        }
     }
+    zz_normalize(w);
     return ZZ_OK;
 }
 
-zz_err
-zz_xor(const zz_t *u, const zz_t *v, zz_t *w)
+static zz_err
+zz_addsub_u64(const zz_t *u, uint64_t v, bool negv, zz_t *w)
+{
+    bool negu = ISNEG(u), same_sign = negu == negv, v_size = v != 0;
+    zz_size_t u_size = u->size;
+
+    if (!u_size) {
+        if (v_size) {
+            if (zz_resize(v_size, w)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+            w->digits[0] = v;
+            SETNEG(negv, w);
+        }
+        else {
+            w->size = 0;
+            SETNEG(false, w);
+        }
+        return ZZ_OK;
+    }
+    if (same_sign && u_size == ZZ_DIGITS_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    if (zz_resize(u_size + same_sign, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(negu, w);
+    if (same_sign) {
+        if (!(w->digits[u_size] = mpn_add_1(w->digits, u->digits, u_size, v))) {
+            w->size--;
+        }
+    }
+    else if (u_size > 1) {
+        mpn_sub_1(w->digits, u->digits, u_size, v);
+        w->size -= w->digits[w->size - 1] == 0;
+    }
+
+    else {
+        if (u->digits[0] < v) {
+            w->digits[0] = v - u->digits[0];
+            SETNEG(negv, w);
+        }
+        else {
+            w->digits[0] = u->digits[0] - v;
+            if (!w->digits[0]) {
+                w->size = 0;
+                SETNEG(false, w);
+            }
+        }
+    }
+    return ZZ_OK;
+}
+
+zz_err
+zz_addsub_i64(const zz_t *u, int64_t v, bool subtract, zz_t *w)
+{
+    bool negv = v < 0;
+    uint64_t uv = ABS_CAST(uint64_t, v);
+
+    return zz_addsub_u64(u, uv, subtract ? !negv : negv, w);
+}
+
+zz_err
+zz_add(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_ADD);
+
+    return zz_addsub(u, v, false, w);
+}
+
+zz_err
+zz_sub(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_ADD);
+
+    return zz_addsub(u, v, true, w);
+}
+
+zz_err
+zz_add_u64(const zz_t *u, uint64_t v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_ADD);
+
+    return zz_addsub_u64(u, v, false, w);
+}
+
+zz_err
+zz_sub_u64(const zz_t *u, uint64_t v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_ADD);
+
+    return zz_addsub_u64(u, v, true, w);
+}
+
+zz_err
+zz_u64_sub(uint64_t u, const zz_t *v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_ADD);
+
+    if (zz_neg(v, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    return zz_addsub_u64(w, u, false, w);
+}
+
+zz_err
+zz_add_i64(const zz_t *u, int64_t v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_ADD);
+
+    return zz_addsub_i64(u, v, false, w);
+}
+
+zz_err
+zz_sub_i64(const zz_t *u, int64_t v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_ADD);
+
+    return zz_addsub_i64(u, v, true, w);
+}
+
+zz_err
+zz_i64_sub(int64_t u, const zz_t *v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_ADD);
+
+    if (zz_neg(v, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    return zz_addsub_i64(w, u, false, w);
+}
+
+/* Schoolbook multiplication for small vn, without temporary allocations
+   (hence, without setjmp() overhead), unlike mpn_mul().  Requires un >= vn
+   and no overlap of rp with inputs. */
+#define MUL_BASECASE_MAX 8
+
+static void
+zz_mul_basecase(zz_digit_t *rp, const zz_digit_t *up, zz_size_t un,
+                const zz_digit_t *vp, zz_size_t vn)
+{
+    rp[un] = mpn_mul_1(rp, up, un, vp[0]);
+    for (zz_size_t i = 1; i < vn; i++) {
+        rp[un + i] = mpn_addmul_1(rp + i, up, un, vp[i]);
+    }
+}
+
+zz_err
+zz_mul(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_MUL);
+
+    if (u->size < v->size) {
+        SWAP(const zz_t *, u, v);
+    }
+    if (v->size <= 1) {
+        bool w_negative = ISNEG(u) != ISNEG(v); /* in case v == w */
+        zz_err ret = zz_mul_u64(u, v->size ? v->digits[0] : 0, w);
+
+        if (w->size) {
+            SETNEG(w_negative, w);
+        }
+        return ret;
+    }
+
+    uint64_t w_size = (uint64_t)u->size + (uint64_t)v->size;
+
+    if (w_size > ZZ_DIGITS_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    /* Scratch space of GMP's multiplication is within 2*w_size */
+    if (zz_over_budget((double)w_size
+                       * (v->size <= MUL_BASECASE_MAX ? 1 : 3)))
+    {
+        return ZZ_LIM;
+    }
+    if (u == w) {
+        zz_t tmp;
+
+        if (zz_save(w, &tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+
+        zz_err ret = u == v ? zz_mul(&tmp, &tmp, w) : zz_mul(&tmp, v, w);
+
+        zz_clear(&tmp);
+        return ret;
+    }
+    if (v == w) {
+        zz_t tmp;
+
+        if (zz_save(w, &tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+
+        zz_err ret = zz_mul(u, &tmp, w);
+
+        zz_clear(&tmp);
+        return ret;
+    }
+    if (zz_resize((zz_size_t)w_size, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(ISNEG(u) != ISNEG(v), w);
+    if (v->size <= MUL_BASECASE_MAX) {
+        zz_mul_basecase(w->digits, u->digits, u->size, v->digits, v->size);
+    }
+    else if (TMP_OVERFLOW) {
+        return ZZ_MEM;
+    }
+    else if (u->size == v->size) {
+        if (u != v) {
+            mpn_mul_n(w->digits, u->digits, v->digits, u->size);
+        }
+        else {
+            mpn_sqr(w->digits, u->digits, u->size);
+        }
+    }
+    else {
+        mpn_mul(w->digits, u->digits, u->size, v->digits, v->size);
+    }
+    w->size -= w->digits[w->size - 1] == 0;
+    assert(w->size >= 1);
+    return ZZ_OK;
+}
+
+zz_err
+zz_mul_u64(const zz_t *u, uint64_t v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_MUL);
+
+    zz_size_t u_size = u->size;
+
+    if (!u_size || !v) {
+        return zz_set_i64(0, w);
+    }
+    if (u_size == ZZ_DIGITS_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    /* mpn_mul_1() doesn't allocate memory */
+    if (zz_resize(u_size + 1, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(ISNEG(u), w);
+    w->digits[u_size] = mpn_mul_1(w->digits, u->digits, u_size, v);
+    w->size -= w->digits[u_size] == 0;
+    assert(w->size >= 1);
+    return ZZ_OK;
+}
+
+zz_err
+zz_mul_i64(const zz_t *u, int64_t v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_MUL);
+
+    zz_err ret = zz_mul_u64(u, ABS_CAST(zz_digit_t, v), w);
+
+    if (w->size) {
+        SETNEG(ISNEG(u) != (v < 0), w);
+    }
+    return ret;
+}
+
+/* Set w to w + u*v, if negative is false, else to w - u*v.  Digits of w
+   are updated in place with mpn_addmul_1() or mpn_submul_1(). */
+static zz_err
+zz_addmul_1(const zz_t *u, zz_digit_t v, bool negative, zz_t *w)
+{
+    if (!u->size || !v) {
+        return ZZ_OK;
+    }
+    if (u == w) {
+        zz_t tmp;
+
+        if (zz_init(&tmp) || zz_pos(u, &tmp)) {
+            /* LCOV_EXCL_START */
+            zz_clear(&tmp);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
+        }
+
+        zz_err ret = zz_addmul_1(&tmp, v, negative, w);
+
+        zz_clear(&tmp);
+        return ret;
+    }
+
+    bool p_negative = ISNEG(u) != negative;
+    zz_size_t u_size = u->size, w_size = w->size;
+    zz_size_t size = MAX(u_size, w_size);
+
+    if (size == ZZ_DIGITS_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    /* The result fits in size + 1 digits */
+    size++;
+    if (zz_resize(size, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    mpn_zero(w->digits + w_size, size - w_size);
+    if (!w_size || ISNEG(w) == p_negative) {
+        zz_digit_t cy = mpn_addmul_1(w->digits, u->digits, u_size, v);
+
+        (void)mpn_add_1(w->digits + u_size, w->digits + u_size,
+                        size - u_size, cy);
+        SETNEG(p_negative, w);
+    }
+    else {
+        zz_digit_t bw = mpn_submul_1(w->digits, u->digits, u_size, v);
+
+        if (mpn_sub_1(w->digits + u_size, w->digits + u_size,
+                      size - u_size, bw))
+        {
+            mpn_neg(w->digits, w->digits, size);
+            SETNEG(p_negative, w);
+        }
+    }
+    zz_normalize(w);
+    return ZZ_OK;
+}
+
+/* Set w to w + u*v or w - u*v.  The product is computed in the temporary
+   storage, then added to digits of w in place. */
+static zz_err
+zz_addmul_impl(const zz_t *u, const zz_t *v, bool negative, zz_t *w)
+{
+    if (u->size < v->size) {
+        SWAP(const zz_t *, u, v);
+    }
+    if (v->size <= 1) {
+        return zz_addmul_1(u, v->size ? v->digits[0] : 0,
+                           ISNEG(v) != negative, w);
+    }
+
+    if ((uint64_t)u->size + (uint64_t)v->size >= ZZ_DIGITS_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+
+    zz_size_t p_size = u->size + v->size;
+
+    /* The product, the result and scratch space of multiplication */
+    if (zz_over_budget((double)p_size
+                       * (v->size <= MUL_BASECASE_MAX ? 2 : 4)))
+    {
+        return ZZ_LIM;
+    }
+
+    zz_digit_t *p = TMP_ALLOC((size_t)p_size * ZZ_DIGIT_T_BYTES);
+
+    if (!p) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    if (v->size <= MUL_BASECASE_MAX) {
+        zz_mul_basecase(p, u->digits, u->size, v->digits, v->size);
+    }
+    else if (TMP_OVERFLOW) {
+        TMP_FREE(p);
+        return ZZ_MEM;
+    }
+    else if (u == v) {
+        mpn_sqr(p, u->digits, u->size);
+    }
+    else {
+        mpn_mul(p, u->digits, u->size, v->digits, v->size);
+    }
+    p_size -= p[p_size - 1] == 0;
+
+    bool p_negative = (ISNEG(u) != ISNEG(v)) != negative;
+    zz_size_t w_size = w->size;
+    zz_size_t size = MAX(p_size, w_size);
+
+    if (size == ZZ_DIGITS_MAX) {
+        TMP_FREE(p);
+        return ZZ_BUF;
+    }
+    size++;
+    if (zz_resize(size, w)) {
+        /* LCOV_EXCL_START */
+        TMP_FREE(p);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    mpn_zero(w->digits + w_size, size - w_size);
+    if (!w_size || ISNEG(w) == p_negative) {
+        zz_digit_t cy = mpn_add_n(w->digits, w->digits, p, p_size);
+
+        (void)mpn_add_1(w->digits + p_size, w->digits + p_size,
+                        size - p_size, cy);
+        SETNEG(p_negative, w);
+    }
+    else {
+        zz_digit_t bw = mpn_sub_n(w->digits, w->digits, p, p_size);
+
+        if (mpn_sub_1(w->digits + p_size, w->digits + p_size,
+                      size - p_size, bw))
+        {
+            mpn_neg(w->digits, w->digits, size);
+            SETNEG(p_negative, w);
+        }
+    }
+    TMP_FREE(p);
+    zz_normalize(w);
+    return ZZ_OK;
+}
+
+zz_err
+zz_addmul(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_MUL);
+
+    return zz_addmul_impl(u, v, false, w);
+}
+
+zz_err
+zz_submul(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_MUL);
+
+    return zz_addmul_impl(u, v, true, w);
+}
+
+zz_err
+zz_addmul_u64(const zz_t *u, uint64_t v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_MUL);
+
+    return zz_addmul_1(u, v, false, w);
+}
+
+zz_err
+zz_addmul_i64(const zz_t *u, int64_t v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_MUL);
+
+    return zz_addmul_1(u, ABS_CAST(zz_digit_t, v), v < 0, w);
+}
+
+zz_err
+zz_submul_u64(const zz_t *u, uint64_t v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_MUL);
+
+    return zz_addmul_1(u, v, true, w);
+}
+
+zz_err
+zz_submul_i64(const zz_t *u, int64_t v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_MUL);
+
+    return zz_addmul_1(u, ABS_CAST(zz_digit_t, v), v >= 0, w);
+}
+
+zz_err
+zz_div(const zz_t *u, const zz_t *v, zz_t *q, zz_t *r)
+{
+    STATS_ENTER(ZZ_STATS_DIV);
+
+    if (!v->size) {
+        return ZZ_VAL;
+    }
+    if (!q || !r) {
+        if (!q && !r) {
+            return ZZ_OK;
+        }
+        return q ? zz_quo(u, v, q) : zz_mod(u, v, r);
+    }
+    if (u == q || u == r) {
+        zz_t tmp;
+
+        if (zz_save(u == q ? q : r, &tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+
+        zz_err ret = zz_div(&tmp, u == v ? &tmp : v, q, r);
+
+        zz_clear(&tmp);
+        return ret;
+    }
+    if (v == q || v == r) {
+        zz_t tmp;
+
+        if (zz_save(v == q ? q : r, &tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+
+        zz_err ret = zz_div(u, &tmp, q, r);
+
+        zz_clear(&tmp);
+        return ret;
+    }
+    if (!u->size) {
+        if (zz_set_i64(0, q) || zz_set_i64(0, r)) {
+            goto err; /* LCOV_EXCL_LINE */
+        }
+    }
+    else if (u->size < v->size) {
+        if (ISNEG(u) != ISNEG(v)) {
+            if (zz_set_i64(-1, q) || zz_add(u, v, r)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+        }
+        else {
+            if (zz_set_i64(0, q) || zz_pos(u, r)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+        }
+    }
+    else {
+        zz_size_t u_size = u->size;
+
+        if (zz_resize(u_size - v->size + 1, q) || zz_resize(v->size, r)) {
+            goto err; /* LCOV_EXCL_LINE */
+        }
+        SETNEG(ISNEG(u) != ISNEG(v), q);
+        SETNEG(ISNEG(v), r);
+        if (v->size == 1) {
+            /* mpn_divrem_1() doesn't allocate memory */
+            r->digits[0] = mpn_divrem_1(q->digits, 0, u->digits, u_size,
+                                        v->digits[0]);
+        }
+        else {
+            if (TMP_OVERFLOW) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            mpn_tdiv_qr(q->digits, r->digits, 0, u->digits, u_size,
+                        v->digits, v->size);
+        }
+        q->size -= q->digits[q->size - 1] == 0;
+        zz_normalize(r);
+        if (ISNEG(q) && r->size) {
+            /* Note that we can't get carry here for q of maximal size,
+               as this would mean |v| == 1, thus: r == 0 */
+            assert(q->size < ZZ_DIGITS_MAX);
+            if (zz_sub_i64(q, 1, q)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            r->size = v->size;
+            mpn_sub_n(r->digits, v->digits, r->digits, v->size);
+            zz_normalize(r);
+        }
+    }
+    return ZZ_OK;
+    /* LCOV_EXCL_START */
+err:
+    zz_clear(q);
+    zz_clear(r);
+    return ZZ_MEM;
+    /* LCOV_EXCL_STOP */
+}
+
+zz_err
+zz_div_i64(const zz_t *u, int64_t v, zz_t *q, zz_t *r)
+{
+    STATS_ENTER(ZZ_STATS_DIV);
+
+    if (!v) {
+        return ZZ_VAL;
+    }
+
+    zz_digit_t rl = 0, uv = ABS_CAST(zz_digit_t, v);
+    zz_size_t u_size = u->size;
+    bool same_signs = ISNEG(u) == (v < 0);
+
+    /* Remainder is the byproduct of the quotient computation, so the
+       dividend is scanned only once.  Note that q might be u. */
+    if (q) {
+        if (u_size) {
+            if (zz_resize(u_size, q)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+            rl = mpn_divrem_1(q->digits, 0, u->digits, u_size, uv);
+            if (rl && !same_signs) {
+                mpn_add_1(q->digits, q->digits, q->size, 1);
+            }
+            q->size -= q->digits[q->size - 1] == 0;
+            SETNEG(q->size ? !same_signs : false, q);
+        }
+        else {
+            (void)zz_set_i32(0, q);
+        }
+    }
+    else if (u_size) {
+        rl = mpn_mod_1(u->digits, u_size, uv);
+    }
+    if (r) {
+        if (!rl) {
+            return zz_set_i32(0, r);
+        }
+        if (zz_resize(1, r)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        r->digits[0] = same_signs ? rl : uv - rl;
+        SETNEG(v < 0, r);
+    }
+    return ZZ_OK;
+}
+
+zz_err
+zz_divisor_u64(uint64_t v, zz_divisor_t *d)
+{
+    if (!v) {
+        return ZZ_VAL;
+    }
+
+    zz_digit_t dn = v;
+
+    d->d = v;
+    d->shift = ZZ_DIGIT_T_BITS - (unsigned int)mpn_sizeinbase(&dn, 1, 2);
+    dn <<= d->shift;
+#if defined(__SIZEOF_INT128__)
+    /* floor((B^2 - 1)/dn) - B, where B = 2^64 */
+    d->inv = (zz_digit_t)((((zz_dlimb_t)~dn << ZZ_DIGIT_T_BITS)
+                           | ZZ_DIGIT_T_MAX) / dn);
+#else
+    d->inv = 0;
+#endif
+    return ZZ_OK;
+}
+
+#if defined(__SIZEOF_INT128__)
+/* Divide {u1, u0} by the normalized digit dn, given u1 < dn and it's
+   precomputed inverse.  This is Algorithm 4 from: N. Moller and T. Granlund,
+   Improved division by invariant integers, IEEE Trans. Comput. 60 (2011). */
+static inline zz_digit_t
+udiv_qrnnd_preinv(zz_digit_t u1, zz_digit_t u0, zz_digit_t dn,
+                  zz_digit_t inv, zz_digit_t *r)
+{
+    zz_dlimb_t p = (zz_dlimb_t)inv*u1;
+
+    p += ((zz_dlimb_t)(u1 + 1) << ZZ_DIGIT_T_BITS) | u0;
+
+    zz_digit_t q1 = (zz_digit_t)(p >> ZZ_DIGIT_T_BITS), q0 = (zz_digit_t)p;
+    zz_digit_t rl = u0 - q1*dn;
+
+    if (rl > q0) {
+        q1--;
+        rl += dn;
+    }
+    if (rl >= dn) {
+        q1++; /* LCOV_EXCL_LINE */
+        rl -= dn; /* LCOV_EXCL_LINE */
+    }
+    *r = rl;
+    return q1;
+}
+#endif
+
+/* For longer dividends, the remainder alone is computed faster by
+   mpn_mod_1(), which handles several digits per step. */
+#define PREINV_MOD_MAX_DIGITS 12
+
+/* Set {qp, n} to the quotient of {up, n} by the divisor (unless qp is NULL)
+   and return the remainder.  The qp might be equal to up. */
+static zz_digit_t
+zz_divrem_preinv(zz_digit_t *qp, const zz_digit_t *up, zz_size_t n,
+                 const zz_divisor_t *d)
+{
+#if defined(__SIZEOF_INT128__)
+    if (!qp && n > PREINV_MOD_MAX_DIGITS) {
+        return mpn_mod_1(up, n, d->d);
+    }
+
+    unsigned int s = d->shift;
+    zz_digit_t dn = (zz_digit_t)d->d << s, inv = d->inv, rl = 0, ql;
+
+    if (!s) {
+        for (zz_size_t i = n - 1; i >= 0; i--) {
+            ql = udiv_qrnnd_preinv(rl, up[i], dn, inv, &rl);
+            if (qp) {
+                qp[i] = ql;
+            }
+        }
+        return rl;
+    }
+    /* Shift the dividend on the fly, digits of up[] are read before
+       the same position in qp[] is written. */
+    rl = up[n - 1] >> (ZZ_DIGIT_T_BITS - s);
+    for (zz_size_t i = n - 1; i > 0; i--) {
+        zz_digit_t u0 = (up[i] << s) | (up[i - 1] >> (ZZ_DIGIT_T_BITS - s));
+
+        ql = udiv_qrnnd_preinv(rl, u0, dn, inv, &rl);
+        if (qp) {
+            qp[i] = ql;
+        }
+    }
+    ql = udiv_qrnnd_preinv(rl, up[0] << s, dn, inv, &rl);
+    if (qp) {
+        qp[0] = ql;
+    }
+    return rl >> s;
+#else
+    if (qp) {
+        return mpn_divrem_1(qp, 0, up, n, d->d);
+    }
+    return mpn_mod_1(up, n, d->d);
+#endif
+}
+
+zz_err
+zz_div_divisor(const zz_t *u, const zz_divisor_t *d, zz_t *q, uint64_t *r)
+{
+    STATS_ENTER(ZZ_STATS_DIV);
+
+    zz_digit_t rl = 0;
+    zz_size_t u_size = u->size;
+    bool negative = ISNEG(u);
+
+    if (q) {
+        if (u_size) {
+            if (zz_resize(u_size, q)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+            rl = zz_divrem_preinv(q->digits, u->digits, u_size, d);
+            if (rl && negative) {
+                mpn_add_1(q->digits, q->digits, q->size, 1);
+            }
+            q->size -= q->digits[q->size - 1] == 0;
+            SETNEG(q->size ? negative : false, q);
+        }
+        else {
+            (void)zz_set_i32(0, q);
+        }
+    }
+    else if (u_size) {
+        rl = zz_divrem_preinv(NULL, u->digits, u_size, d);
+    }
+    if (r) {
+        *r = rl && negative ? d->d - rl : rl;
+    }
+    return ZZ_OK;
+}
+
+zz_err
+zz_quo_divisor(const zz_t *u, const zz_divisor_t *d, zz_t *q)
+{
+    return zz_div_divisor(u, d, q, NULL);
+}
+
+uint64_t
+zz_mod_divisor(const zz_t *u, const zz_divisor_t *d)
+{
+    uint64_t r;
+
+    (void)zz_div_divisor(u, d, NULL, &r);
+    return r;
+}
+
+static int64_t
+fdiv_r(int64_t a, int64_t b)
+{
+    return a/b - (a%b != 0 && (a^b) < 0);
+}
+
+zz_err
+zz_i64_div(int64_t u, const zz_t *v, zz_t *q, zz_t *r)
+{
+    STATS_ENTER(ZZ_STATS_DIV);
+
+    if (!v->size) {
+        return ZZ_VAL;
+    }
+
+    int64_t sv;
+
+    if (q) {
+        zz_err ret = ZZ_OK;
+
+        if (zz_get_i64(v, &sv)) {
+            ret = zz_set_i64((u < 0) == ISNEG(v) || !u ? 0 : -1, q);
+        }
+        else {
+            ret = zz_set_i64(fdiv_r(u, sv), q);
+        }
+        if (ret || !r) {
+            return ret; /* LCOV_EXCL_LINE */
+        }
+    }
+    if (r) {
+        if (zz_get_i64(v, &sv)) {
+            if ((u < 0) == ISNEG(v) || !u) {
+                return zz_set_i64(u, r);
+            }
+            return zz_add_i64(v, u, r);
+        }
+        return zz_set_i64(u - fdiv_r(u, sv)*sv, r);
+    }
+    return ZZ_OK;
+}
+
+zz_err
+zz_quo(const zz_t *u, const zz_t *v, zz_t *q)
+{
+    STATS_ENTER(ZZ_STATS_DIV);
+
+    if (!v->size) {
+        return ZZ_VAL;
+    }
+
+    bool negative = ISNEG(u) != ISNEG(v);
+
+    if (u->size < v->size) {
+        return zz_set_i64(negative && u->size ? -1 : 0, q);
+    }
+    if (v->size == 1) {
+        zz_size_t u_size = u->size;
+        zz_digit_t d = v->digits[0];
+
+        /* mpn_divrem_1() doesn't allocate memory and allows in-place
+           division */
+        if (zz_resize(u_size, q)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        if (mpn_divrem_1(q->digits, 0, u->digits, u_size, d) && negative) {
+            /* Here d > 1, thus no carry */
+            (void)mpn_add_1(q->digits, q->digits, u_size, 1);
+        }
+        SETNEG(negative, q);
+        zz_normalize(q);
+        return ZZ_OK;
+    }
+    if (u == q || v == q) {
+        zz_t tmp;
+
+        if (zz_save(q, &tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+
+        zz_err ret = zz_quo(u == q ? &tmp : u, v == q ? &tmp : v, q);
+
+        zz_clear(&tmp);
+        return ret;
+    }
+
+    zz_size_t u_size = u->size, v_size = v->size;
+    /* The remainder is needed only to round the quotient */
+    zz_digit_t *r = TMP_ALLOC((size_t)v_size * ZZ_DIGIT_T_BYTES);
+
+    if (!r || zz_resize(u_size - v_size + 1, q)) {
+        /* LCOV_EXCL_START */
+        TMP_FREE(r);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    if (TMP_OVERFLOW) {
+        TMP_FREE(r);
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    mpn_tdiv_qr(q->digits, r, 0, u->digits, u_size, v->digits, v_size);
+    if (negative && !mpn_zero_p(r, v_size)) {
+        /* No carry, see zz_div() */
+        (void)mpn_add_1(q->digits, q->digits, q->size, 1);
+    }
+    TMP_FREE(r);
+    SETNEG(negative, q);
+    zz_normalize(q);
+    return ZZ_OK;
+}
+
+zz_err
+zz_mod(const zz_t *u, const zz_t *v, zz_t *r)
+{
+    STATS_ENTER(ZZ_STATS_DIV);
+
+    if (!v->size) {
+        return ZZ_VAL;
+    }
+
+    bool negative = ISNEG(u) != ISNEG(v);
+
+    if (u->size < v->size) {
+        if (negative && u->size) {
+            return zz_add(u, v, r);
+        }
+        return zz_pos(u, r);
+    }
+    if (v->size == 1) {
+        zz_digit_t d = v->digits[0];
+        zz_digit_t rl = mpn_mod_1(u->digits, u->size, d);
+        bool r_negative = ISNEG(v);
+
+        if (rl && negative) {
+            rl = d - rl;
+        }
+        if (zz_set_u64(rl, r)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        if (rl) {
+            SETNEG(r_negative, r);
+        }
+        return ZZ_OK;
+    }
+    if (v == r) {
+        zz_t tmp;
+
+        if (zz_save(r, &tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+
+        zz_err ret = zz_mod(u == r ? &tmp : u, &tmp, r);
+
+        zz_clear(&tmp);
+        return ret;
+    }
+
+    zz_size_t u_size = u->size, v_size = v->size;
+    /* mpn_tdiv_qr() can't skip the quotient, it's kept in the temporary
+       storage.  The remainder might be computed in place (if r == u). */
+    zz_digit_t *q = TMP_ALLOC((size_t)(u_size - v_size + 1)
+                              * ZZ_DIGIT_T_BYTES);
+
+    if (!q || zz_resize(v_size, r)) {
+        /* LCOV_EXCL_START */
+        TMP_FREE(q);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    if (TMP_OVERFLOW) {
+        TMP_FREE(q);
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    mpn_tdiv_qr(q, r->digits, 0, u->digits, u_size, v->digits, v_size);
+    TMP_FREE(q);
+    SETNEG(ISNEG(v), r);
+    zz_normalize(r);
+    if (negative && r->size) {
+        r->size = v_size;
+        mpn_sub_n(r->digits, v->digits, r->digits, v_size);
+        zz_normalize(r);
+    }
+    return ZZ_OK;
+}
+
+/* Set q to u/v for single-digit v (the sign is given separately), with
+   mpn_divexact_1(). */
+static zz_err
+zz_divexact_1(const zz_t *u, zz_digit_t v, bool negative, zz_t *q)
+{
+    zz_size_t u_size = u->size;
+    bool q_negative = ISNEG(u) != negative;
+
+    /* mpn_divexact_1() doesn't allocate memory and allows in-place
+       division */
+    if (zz_resize(u_size, q)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    mpn_divexact_1(q->digits, u->digits, u_size, v);
+    SETNEG(q_negative, q);
+    zz_normalize(q);
+    return ZZ_OK;
+}
+
+zz_err
+zz_divexact(const zz_t *u, const zz_t *v, zz_t *q)
+{
+    STATS_ENTER(ZZ_STATS_DIV);
+
+    if (!v->size) {
+        return ZZ_VAL;
+    }
+    if (u->size < v->size) {
+        return zz_set_i64(0, q);
+    }
+    if (v->size == 1) {
+        return zz_divexact_1(u, v->digits[0], ISNEG(v), q);
+    }
+    if (u == q || v == q) {
+        zz_t tmp;
+
+        if (zz_save(q, &tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+
+        zz_err ret = zz_divexact(u == q ? &tmp : u, v == q ? &tmp : v, q);
+
+        zz_clear(&tmp);
+        return ret;
+    }
+
+    zz_size_t u_size = u->size;
+
+    if (zz_resize(u_size - v->size + 1, q) || TMP_OVERFLOW) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(ISNEG(u) != ISNEG(v), q);
+    mpn_divexact(q->digits, u->digits, u_size, v->digits, v->size);
+    zz_normalize(q);
+    return ZZ_OK;
+}
+
+zz_err
+zz_divexact_u64(const zz_t *u, uint64_t v, zz_t *q)
+{
+    STATS_ENTER(ZZ_STATS_DIV);
+
+    if (!v) {
+        return ZZ_VAL;
+    }
+    if (!u->size) {
+        return zz_set_i64(0, q);
+    }
+    return zz_divexact_1(u, v, false, q);
+}
+
+zz_err
+zz_quo_2exp(const zz_t *u, zz_bitcnt_t shift, zz_t *v)
+{
+    STATS_ENTER(ZZ_STATS_DIV);
+
+    if (!u->size) {
+        return zz_set_i32(0, v);
+    }
+    if (shift >= (zz_bitcnt_t)u->size*ZZ_DIGIT_T_BITS) {
+        return zz_set_i64(ISNEG(u) ? -1 : 0, v);
+    }
+
+    zz_size_t whole = (zz_size_t)(shift / ZZ_DIGIT_T_BITS);
+    zz_size_t size = u->size - whole;
+    bool carry = false, extra = true;
+
+    shift %= ZZ_DIGIT_T_BITS;
+    for (mp_size_t i = 0; i < whole; i++) {
+        if (u->digits[i]) {
+            carry = ISNEG(u);
+            break;
+        }
+    }
+    for (mp_size_t i = whole; i < u->size; i++) {
+        if (u->digits[i] != ZZ_DIGIT_T_MAX) {
+            extra = 0;
+            break;
+        }
+    }
+    if (zz_resize(size + extra, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(ISNEG(u), v);
+    if (shift) {
+        if (mpn_rshift(v->digits, u->digits + whole, size,
+                       (unsigned int)shift))
+        {
+            carry = ISNEG(u);
+        }
+    }
+    else {
+        mpn_copyi(v->digits, u->digits + whole, size);
+    }
+    if (extra) {
+        v->digits[size] = 0;
+    }
+    if (carry) {
+        if (mpn_add_1(v->digits, v->digits, size, 1)) {
+            v->digits[size] = 1;
+        }
+    }
+    zz_normalize(v);
+    return ZZ_OK;
+}
+
+zz_err
+zz_mul_2exp(const zz_t *u, zz_bitcnt_t shift, zz_t *v)
+{
+    STATS_ENTER(ZZ_STATS_MUL);
+
+    if (!u->size) {
+        return zz_set_i32(0, v);
+    }
+    if (shift > ZZ_BITS_MAX) {
+        return ZZ_BUF;
+    }
+
+    zz_size_t whole = (zz_size_t)(shift / ZZ_DIGIT_T_BITS);
+    zz_size_t u_size = u->size;
+    int64_t v_size = (int64_t)u_size + whole;
+
+    shift %= ZZ_DIGIT_T_BITS;
+    v_size += (bool)shift;
+    if (v_size > ZZ_DIGITS_MAX) {
+        return ZZ_BUF;
+    }
+    if (zz_over_budget((double)v_size)) {
+        return ZZ_LIM;
+    }
+    if (zz_resize((zz_size_t)v_size, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(ISNEG(u), v);
+    if (shift) {
+        v->size -= !(bool)(v->digits[v->size - 1]
+                           = mpn_lshift(v->digits + whole,
+                                        u->digits, u_size,
+                                        (unsigned int)shift));
+    }
+    else {
+        mpn_copyd(v->digits + whole, u->digits, u_size);
+    }
+    mpn_zero(v->digits, whole);
+    return ZZ_OK;
+}
+
+zz_err
+zz_invert(const zz_t *u, zz_t *v)
+{
+    STATS_ENTER(ZZ_STATS_BITWISE);
+
+    zz_size_t u_size = u->size;
+
+    if (ISNEG(u)) {
+        if (zz_resize(u_size, v)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        mpn_sub_1(v->digits, u->digits, u_size, 1);
+        v->size -= v->digits[u_size - 1] == 0;
+    }
+    else if (!u_size) {
+        return zz_set_i64(-1, v);
+    }
+    else {
+        if (u_size == ZZ_DIGITS_MAX) {
+            return ZZ_BUF; /* LCOV_EXCL_LINE */
+        }
+        if (zz_resize(u_size + 1, v)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        v->digits[u_size] = mpn_add_1(v->digits, u->digits, u_size, 1);
+        v->size -= v->digits[u_size] == 0;
+    }
+    SETNEG(!ISNEG(u), v);
+    return ZZ_OK;
+}
+
+zz_err
+zz_and(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_BITWISE);
+
+    if (!u->size || !v->size) {
+        return zz_set_i64(0, w);
+    }
+
+    zz_size_t u_size = u->size, v_size = v->size;
+
+    if (ISNEG(u) || ISNEG(v)) {
+        zz_t o1, o2;
+        zz_err ret = ZZ_MEM;
+
+        if (zz_init(&o1) || zz_init(&o2)) {
+            /* LCOV_EXCL_START */
+err:
+            zz_clear(&o1);
+            zz_clear(&o2);
+            return ret;
+            /* LCOV_EXCL_STOP */
+        }
+        if (ISNEG(u)) {
+            ret = zz_invert(u, &o1);
+            if (ret) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(true, &o1);
+            u = &o1;
+            u_size = u->size;
+        }
+        if (ISNEG(v)) {
+            ret = zz_invert(v, &o2);
+            if (ret) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(true, &o2);
+            v = &o2;
+            v_size = v->size;
+        }
+        if (u_size < v_size) {
+            SWAP(const zz_t *, u, v);
+            SWAP(zz_size_t, u_size, v_size);
+        }
+        if (ISNEG(u) && ISNEG(v)) {
+            if (!u_size) {
+                zz_clear(&o1);
+                zz_clear(&o2);
+                return zz_set_i64(-1, w);
+            }
+            if (u_size == ZZ_DIGITS_MAX) {
+                return ZZ_BUF; /* LCOV_EXCL_LINE */
+            }
+            if (zz_resize(u_size + 1, w)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(true, w);
+            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
+            if (v_size) {
+                mpn_ior_n(w->digits, u->digits, v->digits, v_size);
+            }
+            w->digits[u_size] = mpn_add_1(w->digits, w->digits, u_size, 1);
+            zz_normalize(w);
+            zz_clear(&o1);
+            zz_clear(&o2);
+            return ZZ_OK;
+        }
+        else if (ISNEG(u)) {
+            assert(v_size > 0);
+            if (zz_resize(v_size, w)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(false, w);
+            mpn_andn_n(w->digits, v->digits, u->digits, v_size);
+            zz_normalize(w);
+            zz_clear(&o1);
+            zz_clear(&o2);
+            return ZZ_OK;
+        }
+        else {
+            assert(u_size > 0);
+            if (zz_resize(u_size, w)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(false, w);
+            if (v_size) {
+                mpn_andn_n(w->digits, u->digits, v->digits, v_size);
+            }
+            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
+            zz_normalize(w);
+            zz_clear(&o1);
+            zz_clear(&o2);
+            return ZZ_OK;
+        }
+    }
+    if (u_size < v_size) {
+        SWAP(const zz_t *, u, v);
+        SWAP(zz_size_t, u_size, v_size);
+    }
+    SETNEG(false, w);
+    for (zz_size_t i = v_size; --i >= 0;) {
+        if (u->digits[i] & v->digits[i]) {
+            v_size = i + 1;
+            if (zz_resize(v_size, w)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+            mpn_and_n(w->digits, u->digits, v->digits, v_size);
+            zz_normalize(w);
+            return ZZ_OK;
+        }
+    }
+    w->size = 0;
+    return ZZ_OK;
+}
+
+zz_err
+zz_or(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_BITWISE);
+
+    if (!u->size) {
+        return zz_pos(v, w);
+    }
+    if (!v->size) {
+        return zz_pos(u, w);
+    }
+
+    zz_size_t u_size = u->size, v_size = v->size;
+
+    if (ISNEG(u) || ISNEG(v)) {
+        zz_t o1, o2;
+        zz_err ret = ZZ_MEM;
+
+        if (zz_init(&o1) || zz_init(&o2)) {
+            /* LCOV_EXCL_START */
+err:
+            zz_clear(&o1);
+            zz_clear(&o2);
+            return ret;
+            /* LCOV_EXCL_STOP */
+        }
+        if (ISNEG(u)) {
+            ret = zz_invert(u, &o1);
+            if (ret) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(true, &o1);
+            u = &o1;
+            u_size = u->size;
+        }
+        if (ISNEG(v)) {
+            ret = zz_invert(v, &o2);
+            if (ret) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(true, &o2);
+            v = &o2;
+            v_size = v->size;
+        }
+        if (u_size < v_size) {
+            SWAP(const zz_t *, u, v);
+            SWAP(zz_size_t, u_size, v_size);
+        }
+        if (ISNEG(u) && ISNEG(v)) {
+            if (!v_size) {
+                zz_clear(&o1);
+                zz_clear(&o2);
+                return zz_set_i64(-1, w);
+            }
+            if (v_size == ZZ_DIGITS_MAX) {
+                return ZZ_BUF; /* LCOV_EXCL_LINE */
+            }
+            if (zz_resize(v_size + 1, w)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(true, w);
+            mpn_and_n(w->digits, u->digits, v->digits, v_size);
+            w->digits[v_size] = mpn_add_1(w->digits, w->digits, v_size, 1);
+            zz_normalize(w);
+            zz_clear(&o1);
+            zz_clear(&o2);
+            return ZZ_OK;
+        }
+        else if (ISNEG(u)) {
+            assert(v_size > 0);
+            if (u_size == ZZ_DIGITS_MAX) {
+                return ZZ_BUF; /* LCOV_EXCL_LINE */
+            }
+            if (zz_resize(u_size + 1, w)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(true, w);
+            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
+            mpn_andn_n(w->digits, u->digits, v->digits, v_size);
+            w->digits[u_size] = mpn_add_1(w->digits, w->digits, u_size, 1);
+            zz_normalize(w);
+            zz_clear(&o1);
+            zz_clear(&o2);
+            return ZZ_OK;
+        }
+        else {
+            assert(u_size > 0);
+            if (v_size == ZZ_DIGITS_MAX) {
+                return ZZ_BUF; /* LCOV_EXCL_LINE */
+            }
+            if (zz_resize(v_size + 1, w)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(true, w);
+            if (v_size) {
+                mpn_andn_n(w->digits, v->digits, u->digits, v_size);
+                w->digits[v_size] = mpn_add_1(w->digits, w->digits, v_size, 1);
+                zz_normalize(w);
+            }
+            else {
+                w->digits[0] = 1;
+            }
+            zz_clear(&o1);
+            zz_clear(&o2);
+            return ZZ_OK;
+        }
+    }
+    if (u_size < v_size) {
+        SWAP(const zz_t *, u, v);
+        SWAP(zz_size_t, u_size, v_size);
+    }
+    if (zz_resize(u_size, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(false, w);
+    mpn_ior_n(w->digits, u->digits, v->digits, v_size);
+    if (u_size != v_size) {
+        mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
+    }
+    return ZZ_OK;
+}
+
+zz_err
+zz_xor(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_BITWISE);
+
+    if (!u->size) {
+        return zz_pos(v, w);
+    }
+    if (!v->size) {
+        return zz_pos(u, w);
+    }
+
+    zz_size_t u_size = u->size, v_size = v->size;
+
+    if (ISNEG(u) || ISNEG(v)) {
+        zz_t o1, o2;
+        zz_err ret = ZZ_MEM;
+
+        if (zz_init(&o1) || zz_init(&o2)) {
+            /* LCOV_EXCL_START */
+err:
+            zz_clear(&o1);
+            zz_clear(&o2);
+            return ret;
+            /* LCOV_EXCL_STOP */
+        }
+        if (ISNEG(u)) {
+            ret = zz_invert(u, &o1);
+            if (ret) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(true, &o1);
+            u = &o1;
+            u_size = u->size;
+        }
+        if (ISNEG(v)) {
+            ret = zz_invert(v, &o2);
+            if (ret) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(true, &o2);
+            v = &o2;
+            v_size = v->size;
+        }
+        if (u_size < v_size) {
+            SWAP(const zz_t *, u, v);
+            SWAP(zz_size_t, u_size, v_size);
+        }
+        if (ISNEG(u) && ISNEG(v)) {
+            if (!u_size) {
+                zz_clear(&o1);
+                zz_clear(&o2);
+                return zz_set_i64(0, w);
+            }
+            if (zz_resize(u_size, w)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(false, w);
+            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
+            if (v_size) {
+                mpn_xor_n(w->digits, u->digits, v->digits, v_size);
+            }
+            zz_normalize(w);
+            zz_clear(&o1);
+            zz_clear(&o2);
+            return ZZ_OK;
+        }
+        else if (ISNEG(u)) {
+            assert(v_size > 0);
+            if (u_size == ZZ_DIGITS_MAX) {
+                return ZZ_BUF; /* LCOV_EXCL_LINE */
+            }
+            if (zz_resize(u_size + 1, w)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(true, w);
+            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
+            mpn_xor_n(w->digits, v->digits, u->digits, v_size);
+            w->digits[u_size] = mpn_add_1(w->digits, w->digits, u_size, 1);
+            zz_normalize(w);
+            zz_clear(&o1);
+            zz_clear(&o2);
+            return ZZ_OK;
+        }
+        else {
+            assert(u_size > 0);
+            if (u_size == ZZ_DIGITS_MAX) {
+                return ZZ_BUF; /* LCOV_EXCL_LINE */
+            }
+            if (zz_resize(u_size + 1, w)) {
+                goto err; /* LCOV_EXCL_LINE */
+            }
+            SETNEG(true, w);
+            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
+            if (v_size) {
+                mpn_xor_n(w->digits, u->digits, v->digits, v_size);
+            }
+            w->digits[u_size] = mpn_add_1(w->digits, w->digits, u_size, 1);
+            zz_normalize(w);
+            zz_clear(&o1);
+            zz_clear(&o2);
+            return ZZ_OK;
+        }
+    }
+    if (u_size < v_size) {
+        SWAP(const zz_t *, u, v);
+        SWAP(zz_size_t, u_size, v_size);
+    }
+    if (zz_resize(u_size, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    SETNEG(false, w);
+    mpn_xor_n(w->digits, u->digits, v->digits, v_size);
+    if (u_size != v_size) {
+        mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
+    }
+    else {
+        zz_normalize(w);
+    }
+    return ZZ_OK;
+}
+
+zz_err
+zz_pow(const zz_t *u, uint64_t v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_POW);
+
+    if (!v) {
+        return zz_set_i64(1, w);
+    }
+    if (!u->size) {
+        return zz_set_i64(0, w);
+    }
+    if (zz_cmp_i64(u, 1) == ZZ_EQ) {
+        return zz_set_i64(1, w);
+    }
+    if (v > ZZ_DIGITS_MAX / u->size) {
+        return ZZ_BUF;
+    }
+
+    zz_size_t w_size = (zz_size_t)(v * (zz_digit_t)u->size);
+
+    /* The result, the temporary buffer and scratch space of squaring */
+    if (zz_over_budget(4*(double)w_size)) {
+        return ZZ_LIM;
+    }
+    if (u == w) {
+        zz_t tmp;
+
+        if (zz_save(w, &tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+
+        zz_err ret = zz_pow(&tmp, v, w);
+
+        zz_clear(&tmp);
+        return ret;
+    }
+
+    zz_digit_t *tmp = TMP_ALLOC((size_t)w_size * ZZ_DIGIT_T_BYTES);
+
+    if (!tmp || zz_resize(w_size, w)) {
+        /* LCOV_EXCL_START */
+        TMP_FREE(tmp);
+        zz_clear(w);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    SETNEG(ISNEG(u) && v%2, w);
+    w->size = (zz_size_t)mpn_pow_1(w->digits, u->digits, u->size, v, tmp);
+    TMP_FREE(tmp);
+    if (zz_resize(w->size, w)) {
+        /* LCOV_EXCL_START */
+        zz_clear(w);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    return ZZ_OK;
+}
+
+static zz_err
+zz_gcd(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    if (u->size < v->size) {
+        SWAP(const zz_t *, u, v);
+    }
+    if (!v->size) {
+        return zz_abs(u, w);
+    }
+
+    zz_bitcnt_t shift = MIN(zz_lsbpos(u), zz_lsbpos(v));
+    zz_t *volatile o1 = TMP_ALLOC(sizeof(zz_t));
+    zz_t *volatile o2 = TMP_ALLOC(sizeof(zz_t));
+
+    if (!o1 || !o2) {
+        goto free; /* LCOV_EXCL_LINE */
+    }
+    if (zz_init(o1) || zz_init(o2) || zz_abs(u, o1) || zz_abs(v, o2)) {
+        goto clear; /* LCOV_EXCL_LINE */
+    }
+    if (shift && (zz_quo_2exp(o1, shift, o1) || zz_quo_2exp(o2, shift, o2))) {
+        goto clear; /* LCOV_EXCL_LINE */
+    }
+    u = o1;
+    v = o2;
+    assert(v->size);
+    /* mpn_gcd() destroys inputs */
+    if (zz_unshare(o1) || zz_unshare(o2) || zz_resize(v->size, w)
+        || TMP_OVERFLOW)
+    {
+        goto clear; /* LCOV_EXCL_LINE */
+    }
+    if (v->size == 1) {
+        w->digits[0] = mpn_gcd_1(u->digits, u->size, v->digits[0]);
+    }
+    else {
+        w->size = (zz_size_t)mpn_gcd(w->digits, u->digits, u->size, v->digits,
+                                     v->size);
+    }
+    SETNEG(false, w);
+    zz_clear(o1);
+    zz_clear(o2);
+    TMP_FREE(o1);
+    TMP_FREE(o2);
+    return zz_mul_2exp(w, shift, w);
+    /* LCOV_EXCL_START */
+clear:
+    zz_clear(o1);
+    zz_clear(o2);
+free:
+    TMP_FREE(o1);
+    TMP_FREE(o2);
+    return ZZ_MEM;
+    /* LCOV_EXCL_STOP */
+}
+
+zz_err
+zz_inverse_euclidext(const zz_t *u, const zz_t *v, zz_t *t)
+{
+    zz_t r, newt, newr, q, t1, t2;
+    bool u_neg = ISNEG(u);
+
+    if (zz_init(&r) || zz_init(&newt) || zz_init(&newr)
+        || zz_init(&q) || zz_init(&t1) || zz_init(&t2)
+        || zz_pos(v, &r) || zz_set_i32(1, &newt)
+        || zz_pos(u, &newr) || zz_set_i32(0, t))
+    {
+        /* LCOV_EXCL_START */
+clear2:
+        zz_clear(&r);
+        zz_clear(&newt);
+        zz_clear(&newr);
+        zz_clear(&q);
+        zz_clear(&t1);
+        zz_clear(&t2);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    while (zz_cmp_i64(&newr, 0) != ZZ_EQ) {
+        if (zz_div(&r, &newr, &q, NULL)) {
+            goto clear2; /* LCOV_EXCL_LINE */
+        }
+        if (zz_pos(&newt, &t1) || zz_mul(&q, &newt, &t2)
+            || zz_sub(t, &t2, &newt) || zz_pos(&t1, t))
+        {
+            goto clear2; /* LCOV_EXCL_LINE */
+        }
+        if (zz_pos(&newr, &t1) || zz_mul(&q, &newr, &t2)
+            || zz_sub(&r, &t2, &newr) || zz_pos(&t1, &r))
+        {
+            goto clear2; /* LCOV_EXCL_LINE */
+        }
+    }
+    zz_clear(&newt);
+    zz_clear(&newr);
+    zz_clear(&q);
+    zz_clear(&t1);
+    zz_clear(&t2);
+    if (t->size) {
+        SETNEG(ISNEG(t) != u_neg, t);
+    }
+    (void)zz_abs(&r, &r);
+    if (zz_cmp_i64(&r, 1) != ZZ_EQ) {
+        zz_clear(&r);
+        return ZZ_VAL;
+    }
+    zz_clear(&r);
+    return ZZ_OK;
+}
+
+zz_err
+zz_gcdext(const zz_t *u, const zz_t *v, zz_t *g, zz_t *s, zz_t *t)
+{
+    STATS_ENTER(ZZ_STATS_GCD);
+
+    if (!s && !t) {
+        if (!g) {
+            return ZZ_OK;
+        }
+        return zz_gcd(u, v, g);
+    }
+    if (u->size < v->size) {
+        SWAP(const zz_t *, u, v);
+        SWAP(zz_t *, s, t);
+    }
+    if (!v->size) {
+        if (g) {
+            if (zz_abs(u, g)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+        }
+        if (s) {
+            if (zz_set_i64(ISNEG(u) ? -1 : 1, s)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+            s->size = u->size > 0; /* make 0 if u == 0 */
+        }
+        if (t) {
+            t->size = 0;
+            SETNEG(false, t);
+        }
+        return ZZ_OK;
+    }
+
+    zz_t *volatile o1 = TMP_ALLOC(sizeof(zz_t));
+    zz_t *volatile o2 = TMP_ALLOC(sizeof(zz_t));
+    zz_t *volatile tmp_g = TMP_ALLOC(sizeof(zz_t));
+    zz_t *volatile tmp_s = TMP_ALLOC(sizeof(zz_t));
+    /* v->size + 1 can be > ZZ_DIGITS_MAX, but it should
+       not overflow zz_size_t type */
+    zz_digit_t *volatile tmp_s_digits = TMP_ALLOC(ZZ_DIGIT_T_BYTES
+                                                  * (size_t)(v->size + 1));
+
+    if (!o1 || !o2 || !tmp_g || !tmp_s || !tmp_s_digits) {
+        goto free; /* LCOV_EXCL_LINE */
+    }
+    if (zz_init(o1) || zz_init(o2)
+        || zz_init(tmp_g) || zz_init(tmp_s)
+        || zz_pos(u, o1) || zz_pos(v, o2)
+        /* mpn_gcdext() destroys inputs */
+        || zz_unshare(o1) || zz_unshare(o2)
+        || zz_resize(v->size, tmp_g)
+        || TMP_OVERFLOW)
+    {
+        goto clear; /* LCOV_EXCL_LINE */
+    }
+
+    mp_size_t ssize;
+
+    tmp_g->size = (zz_size_t)mpn_gcdext(tmp_g->digits, tmp_s_digits, &ssize,
+                                        o1->digits, u->size, o2->digits,
+                                        v->size);
+    SETNEG(false, tmp_g);
+    /* Now s either 1 or |s| < v/(2g) */
+    if (zz_resize((zz_size_t)labs(ssize), tmp_s)) {
+        goto clear; /* LCOV_EXCL_LINE */
+    }
+    mpn_copyi(tmp_s->digits, tmp_s_digits, tmp_s->size);
+    SETNEG((ISNEG(u) && ssize > 0) || (!ISNEG(u) && ssize < 0), tmp_s);
+    TMP_FREE(tmp_s_digits);
+    tmp_s_digits = NULL;
+    if (t) {
+        /* Use t = (g - u*s)/v, if no integer overflow is possible,
+           else compute t by Extended Euclidean algorithm */
+        if (MAX(u->size + tmp_s->size, tmp_g->size) < ZZ_DIGITS_MAX) {
+            if (zz_mul(u, tmp_s, o2) || zz_sub(tmp_g, o2, o2)
+                || zz_divexact(o2, v, t))
+            {
+                goto clear; /* LCOV_EXCL_LINE */
+            }
+        }
+        else {
+            /* LCOV_EXCL_START */
+            if (zz_divexact(u, tmp_g, o1) || zz_divexact(v, tmp_g, o2)
+                || zz_inverse_euclidext(o2, o1, t))
+            {
+                goto clear;
+            }
+            /* LCOV_EXCL_STOP */
+        }
+    }
+    zz_clear(o1);
+    zz_clear(o2);
+    TMP_FREE(o1);
+    TMP_FREE(o2);
+    o1 = NULL;
+    o2 = NULL;
+    if (s && zz_pos(tmp_s, s)) {
+        goto clear; /* LCOV_EXCL_LINE */
+    }
+    if (g && zz_pos(tmp_g, g)) {
+        goto clear; /* LCOV_EXCL_LINE */
+    }
+    zz_clear(tmp_s);
+    zz_clear(tmp_g);
+    TMP_FREE(tmp_g);
+    TMP_FREE(tmp_s);
+    return ZZ_OK;
+    /* LCOV_EXCL_START */
+clear:
+    zz_clear(o1);
+    zz_clear(o2);
+    zz_clear(tmp_g);
+    zz_clear(tmp_s);
+free:
+    TMP_FREE(o1);
+    TMP_FREE(o2);
+    TMP_FREE(tmp_g);
+    TMP_FREE(tmp_s);
+    TMP_FREE(tmp_s_digits);
+    return ZZ_MEM;
+    /* LCOV_EXCL_STOP */
+}
+
+static zz_err
+zz_inverse(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    zz_t g;
+
+    if (zz_init(&g) || zz_gcdext(u, v, &g, w, NULL)) {
+        /* LCOV_EXCL_START */
+        zz_clear(&g);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    if (zz_cmp_i64(&g, 1) == ZZ_EQ) {
+        zz_clear(&g);
+        return ZZ_OK;
+    }
+    zz_clear(&g);
+    return ZZ_VAL;
+}
+
+zz_err
+zz_lcm(const zz_t *u, const zz_t *v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_GCD);
+
+    zz_t g;
+    zz_err ret = ZZ_MEM;
+
+    if (zz_init(&g) || zz_gcd(u, v, &g)) {
+        goto end; /* LCOV_EXCL_LINE */
+    }
+    if (zz_iszero(&g)) {
+        zz_clear(&g);
+        return zz_set_i64(0, w);
+    }
+    if (zz_divexact(u, &g, &g)) {
+        goto end; /* LCOV_EXCL_LINE */
+    }
+    ret = zz_mul(&g, v, w);
+end:
+    zz_clear(&g);
+    (void)zz_abs(w, w);
+    return ret;
+}
+
+/* Return the inverse of the normalized two-digit number dp, i.e. the
+   quotient of B^3 - 1 by it, less B.  This doesn't allocate memory. */
+static zz_digit_t
+zz_invert_pi1(const zz_digit_t *dp)
+{
+    zz_digit_t a[3] = {ZZ_DIGIT_T_MAX, ZZ_DIGIT_T_MAX, ZZ_DIGIT_T_MAX};
+    zz_digit_t q[2], rem[2];
+
+    mpn_tdiv_qr(q, rem, 0, a, 3, dp, 2);
+    return q[0];
+}
+
+/* Below this size of the modulus, reduction uses schoolbook division */
+#define MOD_DC_MIN_DIGITS 50
+
+/* Replace {np, un} (un >= n, with room for one more digit) by its remainder
+   modulo ctx->m in the low n digits, using scratch space of un - n + 1 digits
+   at qp.  Must be preceded by the "if (TMP_OVERFLOW)" block. */
+static void
+zz_mod_ctx_divrem(const zz_mod_ctx_t *ctx, zz_digit_t *np, zz_size_t un,
+                  zz_digit_t *qp)
+{
+    zz_size_t n = ctx->m.size;
+    unsigned int shift = ctx->shift;
+
+    if (n == 1) {
+        np[0] = zz_divrem_preinv(NULL, np, un, &ctx->digit);
+    }
+    else if (n == 2 || !ctx->norm.size) {
+        mpn_tdiv_qr(qp, np, 0, np, un, ctx->m.digits, n);
+    }
+    else {
+        np[un] = shift ? mpn_lshift(np, np, un, shift) : 0;
+        if (n < MOD_DC_MIN_DIGITS || un + 1 - n < 3) {
+            (void)mpn_sbpi1_div_qr(qp, np, un + 1, ctx->norm.digits, n,
+                                   ctx->dinv);
+        }
+        else {
+            (void)mpn_dcpi1_div_qr(qp, np, un + 1, ctx->norm.digits, n,
+                                   ctx->dinv);
+        }
+        if (shift) {
+            mpn_rshift(np, np, n, shift);
+        }
+    }
+}
+
+/* Set r to {up, un} mod ctx->m (for the negative sign, the result is
+   adjusted to be nonnegative).  The up might be equal to r->digits. */
+static zz_err
+zz_mod_ctx_rem(const zz_digit_t *up, zz_size_t un, bool negative,
+               const zz_mod_ctx_t *ctx, zz_t *r)
+{
+    const zz_t *m = &ctx->m;
+    zz_size_t n = m->size;
+
+    if (un < n || (un == n && mpn_cmp(up, m->digits, n) < 0)) {
+        bool same = up == r->digits;
+
+        if (!un) {
+            return zz_set_i32(0, r);
+        }
+        if (!negative) {
+            if (!same) {
+                if (zz_resize(un, r)) {
+                    return ZZ_MEM; /* LCOV_EXCL_LINE */
+                }
+                mpn_copyi(r->digits, up, un);
+            }
+            SETNEG(false, r);
+            return ZZ_OK;
+        }
+        if (zz_resize(n, r)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        mpn_sub(r->digits, m->digits, n, same ? r->digits : up, un);
+        SETNEG(false, r);
+        zz_normalize(r);
+        return ZZ_OK;
+    }
+    if (n == 1) {
+        zz_digit_t rl = zz_divrem_preinv(NULL, up, un, &ctx->digit);
+
+        if (rl && negative) {
+            rl = m->digits[0] - rl;
+        }
+        return zz_set_u64(rl, r);
+    }
+
+    /* The dividend (with one extra digit) and the quotient */
+    zz_digit_t *np = TMP_ALLOC((size_t)(2*un - n + 2) * ZZ_DIGIT_T_BYTES);
+
+    if (!np) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    if (TMP_OVERFLOW) {
+        /* LCOV_EXCL_START */
+        TMP_FREE(np);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    mpn_copyi(np, up, un);
+    zz_mod_ctx_divrem(ctx, np, un, np + un + 1);
+
+    zz_size_t size = n;
+
+    while (size && !np[size - 1]) {
+        size--;
+    }
+    if (negative && size) {
+        mpn_sub(np, m->digits, n, np, size);
+        size = n;
+    }
+    if (zz_resize(size, r)) {
+        /* LCOV_EXCL_START */
+        TMP_FREE(np);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    mpn_copyi(r->digits, np, size);
+    TMP_FREE(np);
+    SETNEG(false, r);
+    zz_normalize(r);
+    return ZZ_OK;
+}
+
+/* Precompute data for the modulus ctx->m.  The inverse for reduction is
+   optional: without it, zz_mod_ctx_rem() falls back to mpn_tdiv_qr(). */
+static zz_err
+zz_mod_ctx_prepare(zz_mod_ctx_t *ctx, bool preinv)
+{
+    const zz_t *m = &ctx->m;
+    zz_size_t n = m->size;
+    zz_digit_t top = m->digits[n - 1];
+
+    ctx->shift = ZZ_DIGIT_T_BITS - (unsigned int)mpn_sizeinbase(&top, 1, 2);
+    ctx->dinv = 0;
+    if (n == 1) {
+        (void)zz_divisor_u64(m->digits[0], &ctx->digit);
+    }
+    else if (n > 2 && preinv) {
+        if (zz_mul_2exp(m, ctx->shift, &ctx->norm)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+
+        ctx->dinv = zz_invert_pi1(ctx->norm.digits + n - 2);
+    }
+    ctx->lsbpos = zz_lsbpos(m);
+    if (ctx->lsbpos) {
+        if (zz_quo_2exp(m, ctx->lsbpos, &ctx->odd)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+
+        zz_size_t nodd = ctx->odd.size;
+        zz_size_t neven = (zz_size_t)((ctx->lsbpos + ZZ_DIGIT_T_BITS - 1)
+                                      / ZZ_DIGIT_T_BITS);
+        zz_size_t itch = (zz_size_t)mpn_binvert_itch(neven);
+        zz_digit_t *volatile tp = TMP_ALLOC((size_t)(neven + itch)
+                                            * ZZ_DIGIT_T_BYTES);
+
+        if (!tp || zz_resize(neven, &ctx->inv)) {
+            /* LCOV_EXCL_START */
+            TMP_FREE(tp);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
+        }
+        if (TMP_OVERFLOW) {
+            /* LCOV_EXCL_START */
+            TMP_FREE(tp);
+            return ZZ_MEM;
+            /* LCOV_EXCL_STOP */
+        }
+        /* Pad the odd part with zeros */
+        mpn_copyi(tp, ctx->odd.digits, MIN(nodd, neven));
+        if (nodd < neven) {
+            mpn_zero(tp + nodd, neven - nodd);
+        }
+        mpn_binvert(ctx->inv.digits, tp, neven, tp + neven);
+        TMP_FREE(tp);
+        if (ctx->lsbpos % ZZ_DIGIT_T_BITS) {
+            ctx->inv.digits[neven - 1] &= ((zz_digit_t)1
+                                           << ctx->lsbpos % ZZ_DIGIT_T_BITS) - 1;
+        }
+        zz_normalize(&ctx->inv);
+    }
+    return ZZ_OK;
+}
+
+zz_err
+zz_mod_ctx_init(zz_mod_ctx_t *ctx, const zz_t *m)
+{
+    if (!m->size || ISNEG(m)) {
+        return ZZ_VAL;
+    }
+    if (zz_init(&ctx->m) || zz_init(&ctx->norm) || zz_init(&ctx->odd)
+        || zz_init(&ctx->inv) || zz_pos(m, &ctx->m)
+        || zz_mod_ctx_prepare(ctx, true))
+    {
+        /* LCOV_EXCL_START */
+        zz_mod_ctx_clear(ctx);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    return ZZ_OK;
+}
+
+void
+zz_mod_ctx_clear(zz_mod_ctx_t *ctx)
+{
+    zz_clear(&ctx->m);
+    zz_clear(&ctx->norm);
+    zz_clear(&ctx->odd);
+    zz_clear(&ctx->inv);
+}
+
+zz_err
+zz_mod_reduce(const zz_t *u, const zz_mod_ctx_t *ctx, zz_t *r)
+{
+    STATS_ENTER(ZZ_STATS_DIV);
+
+    return zz_mod_ctx_rem(u->digits, u->size, ISNEG(u), ctx, r);
+}
+
+zz_err
+zz_mod_add(const zz_t *u, const zz_t *v, const zz_mod_ctx_t *ctx, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_ADD);
+
+    if (zz_add(u, v, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    /* For reduced inputs, one subtraction is enough. */
+    if (!ISNEG(w) && zz_cmp(w, &ctx->m) != ZZ_LT
+        && zz_sub(w, &ctx->m, w))
+    {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    return zz_mod_ctx_rem(w->digits, w->size, ISNEG(w), ctx, w);
+}
+
+zz_err
+zz_mod_sub(const zz_t *u, const zz_t *v, const zz_mod_ctx_t *ctx, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_ADD);
+
+    if (zz_sub(u, v, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    if (ISNEG(w) && zz_add(w, &ctx->m, w)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    return zz_mod_ctx_rem(w->digits, w->size, ISNEG(w), ctx, w);
+}
+
+zz_err
+zz_mod_mul(const zz_t *u, const zz_t *v, const zz_mod_ctx_t *ctx, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_MUL);
+
+    if (!u->size || !v->size) {
+        return zz_set_i32(0, w);
+    }
+    if (u->size < v->size) {
+        SWAP(const zz_t *, u, v);
+    }
+    if ((uint64_t)u->size + (uint64_t)v->size >= ZZ_DIGITS_MAX) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+
+    zz_size_t p_size = u->size + v->size;
+    zz_digit_t *p = TMP_ALLOC((size_t)p_size * ZZ_DIGIT_T_BYTES);
+
+    if (!p) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    if (v->size <= MUL_BASECASE_MAX) {
+        zz_mul_basecase(p, u->digits, u->size, v->digits, v->size);
+    }
+    else if (TMP_OVERFLOW) {
+        TMP_FREE(p);
+        return ZZ_MEM;
+    }
+    else if (u == v) {
+        mpn_sqr(p, u->digits, u->size);
+    }
+    else {
+        mpn_mul(p, u->digits, u->size, v->digits, v->size);
+    }
+    p_size -= p[p_size - 1] == 0;
+
+    zz_err ret = zz_mod_ctx_rem(p, p_size, ISNEG(u) != ISNEG(v), ctx, w);
+
+    TMP_FREE(p);
+    return ret;
+}
+
+zz_err
+zz_mod_sqr(const zz_t *u, const zz_mod_ctx_t *ctx, zz_t *w)
+{
+    return zz_mod_mul(u, u, ctx, w);
+}
+
+static zz_err
+_zz_powm(const zz_t *u, const zz_t *v, const zz_mod_ctx_t *ctx, zz_t *res)
+{
+    const zz_t *w = &ctx->m;
+
+    /* Handle (u**1 mod w) early, since mpn_pow* can't */
+    if (zz_cmp_i64(v, 1) == ZZ_EQ) {
+        return zz_mod_ctx_rem(u->digits, u->size, false, ctx, res);
+    }
+
+    zz_bitcnt_t lsbpos = ctx->lsbpos;
+    zz_size_t n = w->size;
+
+    if (lsbpos) {
+        w = &ctx->odd;
+    }
+
+    zz_size_t nodd = w->size;
+    zz_size_t neven = (zz_size_t)(lsbpos + ZZ_DIGIT_T_BITS - 1)/ZZ_DIGIT_T_BITS;
+    zz_size_t itch_binvert = (zz_size_t)mpn_binvert_itch(nodd);
+    zz_size_t itch = n + MAX(itch_binvert, 2*n);
+
+    /* Now w factored as w * BASE**neven */
+    if (neven != 0) {
+        /* We will call both mpn_powm() and mpn_powlo() */
+        itch += 2*n;
+    }
+
+    zz_digit_t *volatile tp = TMP_ALLOC((size_t)itch * sizeof(zz_digit_t));
+    zz_digit_t *volatile newup = NULL;
+    zz_digit_t *volatile rp = tp;
+
+    if (!tp || TMP_OVERFLOW) {
+        /* LCOV_EXCL_START */
+clear:
+        TMP_FREE(rp);
+        TMP_FREE(newup);
+        zz_clear(res);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    tp += n;
+    /* Compute r = u**v mod w */
+    mpn_powm (rp, u->digits, u->size, v->digits, v->size,
+              w->digits, nodd, tp);
+    if (neven != 0) {
+        zz_digit_t *r2, *xp, *yp, *odd_inv_2exp, *up;
+
+        if (u->size < neven) {
+            /* Padd u with zeros. */
+            newup = TMP_ALLOC((size_t)neven * sizeof(zz_digit_t));
+            if (!newup) {
+                goto clear; /* LCOV_EXCL_LINE */
+            }
+            mpn_copyi(newup, u->digits, u->size);
+            mpn_zero(newup + u->size, neven - u->size);
+            up = newup;
+        }
+        else {
+            up = u->digits;
+        }
+        r2 = tp;
+        if (up[0] % 2 == 0) {
+            if (v->size > 1) {
+                mpn_zero(r2, neven);
+                goto zero;
+            }
+        }
+        /* Compute r2 = u**v mod BASE**neven */
+        mpn_powlo(r2, up, v->digits, v->size, neven, tp + neven);
+zero:
+        TMP_FREE(newup);
+        /* odd_inv_2exp = w**(-1) mod BASE**neven, precomputed */
+        odd_inv_2exp = tp + n;
+        mpn_copyi(odd_inv_2exp, ctx->inv.digits, ctx->inv.size);
+        mpn_zero(odd_inv_2exp + ctx->inv.size, neven - ctx->inv.size);
+        /* r2 = r2 - r */
+        mpn_sub(r2, r2, neven, rp, MIN(nodd, neven));
+        xp = tp + 2*n;
+        /* x = (odd_inv_2exp * r2) mod BASE**neven */
+        mpn_mullo_n(xp, odd_inv_2exp, r2, neven);
+        if (lsbpos % ZZ_DIGIT_T_BITS) {
+            xp[neven - 1] &= ((mp_limb_t)1 << lsbpos % ZZ_DIGIT_T_BITS) - 1;
+        }
+        yp = tp;
+        if (neven > nodd) {
+            mpn_mul(yp, xp, neven, w->digits, nodd);
+        }
+        else {
+            mpn_mul(yp, w->digits, nodd, xp, neven);
+        }
+        /* r += x * w */
+        mpn_add(rp, yp, n, rp, nodd);
+    }
+    if (zz_resize(n, res)) {
+        /* LCOV_EXCL_START */
+        TMP_FREE(rp);
+        zz_clear(res);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    mpn_copyi(res->digits, rp, n);
+    TMP_FREE(rp);
+    SETNEG(false, res);
+    zz_normalize(res);
+    return ZZ_OK;
+}
+
+/* Window size for the given exponent length, same thresholds as in the
+   GMP's mpz_powm(). */
+static unsigned int
+zz_mexp_window(zz_bitcnt_t bits)
+{
+    static const zz_bitcnt_t max_bits[] = {7, 25, 81, 241, 673};
+    unsigned int k = 1;
+
+    while (k <= 5 && bits > max_bits[k - 1]) {
+        k++;
+    }
+    return k;
+}
+
+static bool
+zz_mexp_bit(const zz_t *e, int64_t b)
+{
+    return (e->digits[b / ZZ_DIGIT_T_BITS] >> (b % ZZ_DIGIT_T_BITS)) & 1;
+}
+
+/* Return the inverse of the odd digit modulo the base. */
+static zz_digit_t
+zz_binvert_digit(zz_digit_t m0)
 {
-    if (!u->size) {
-        return zz_pos(v, w);
+    zz_digit_t inv = m0;
+
+    /* Newton iteration doubles the number of correct low bits of the
+       inverse, starting from 3. */
+    for (int i = 0; i < 5; i++) {
+        inv *= 2 - m0*inv;
     }
-    if (!v->size) {
-        return zz_pos(u, w);
+    return inv;
+}
+
+#if defined(__SIZEOF_INT128__)
+/* Return the remainder of {u2, u1, u0} by the normalized two-digit d,
+   given (u2, u1) < d and it's inverse (see zz_invert_pi1()).  This is
+   Algorithm 5 from the paper of Moller and Granlund, see above. */
+static inline zz_dlimb_t
+udiv_rnnnd_preinv(zz_digit_t u2, zz_digit_t u1, zz_digit_t u0, zz_dlimb_t d,
+                  zz_digit_t inv)
+{
+    zz_digit_t d1 = (zz_digit_t)(d >> ZZ_DIGIT_T_BITS), d0 = (zz_digit_t)d;
+    zz_dlimb_t q = (zz_dlimb_t)inv*u2;
+
+    q += ((zz_dlimb_t)u2 << ZZ_DIGIT_T_BITS) | u1;
+
+    zz_digit_t q1 = (zz_digit_t)(q >> ZZ_DIGIT_T_BITS), q0 = (zz_digit_t)q;
+    zz_digit_t r1 = u1 - q1*d1;
+    zz_dlimb_t r = ((zz_dlimb_t)r1 << ZZ_DIGIT_T_BITS) | u0;
+
+    r -= (zz_dlimb_t)d0*q1 + d;
+
+    zz_dlimb_t mask = -(zz_dlimb_t)((zz_digit_t)(r >> ZZ_DIGIT_T_BITS) >= q0);
+
+    r += mask & d;
+    if (r >= d) {
+        r -= d; /* LCOV_EXCL_LINE */
     }
+    return r;
+}
 
-    zz_size_t u_size = u->size, v_size = v->size;
+/* Modulus of one or two digits for zz_powm_small(): the value m and it's
+   normalized form d (shifted left to set the highest bit) with the inverse
+   for division.  For Montgomery's reduction (odd moduli only) minv is
+   -1/m mod B. */
+typedef struct {
+    zz_dlimb_t m;
+    zz_dlimb_t d;
+    zz_digit_t inv;
+    zz_digit_t minv;
+    unsigned int shift;
+    bool two;
+} zz_mod2_t;
+
+/* Return {up, un} mod m, digits are shifted on the fly. */
+static zz_dlimb_t
+zz_mod2_rem(const zz_digit_t *up, zz_size_t un, const zz_mod2_t *m)
+{
+    unsigned int s = m->shift;
+    zz_digit_t dn = (zz_digit_t)m->d;
+    zz_dlimb_t r = s ? up[un - 1] >> (ZZ_DIGIT_T_BITS - s) : 0;
 
-    if (ISNEG(u) || ISNEG(v)) {
-        zz_t o1, o2;
-        zz_err ret = ZZ_MEM;
+    if (m->two) {
+        dn = (zz_digit_t)(m->d >> ZZ_DIGIT_T_BITS);
+    }
+    for (zz_size_t i = un - 1; i >= 0; i--) {
+        zz_digit_t ni = up[i] << s;
 
-        if (zz_init(&o1) || zz_init(&o2)) {
-            /* LCOV_EXCL_START */
-err:
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ret;
-            /* LCOV_EXCL_STOP */
+        if (s && i) {
+            ni |= up[i - 1] >> (ZZ_DIGIT_T_BITS - s);
         }
-        if (ISNEG(u)) {
-            ret = zz_invert(u, &o1);
-            if (ret) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, &o1);
-            u = &o1;
-            u_size = u->size;
+        if (m->two) {
+            r = udiv_rnnnd_preinv((zz_digit_t)(r >> ZZ_DIGIT_T_BITS),
+                                  (zz_digit_t)r, ni, m->d, m->inv);
         }
-        if (ISNEG(v)) {
-            ret = zz_invert(v, &o2);
-            if (ret) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, &o2);
-            v = &o2;
-            v_size = v->size;
+        else {
+            zz_digit_t rl;
+
+            (void)udiv_qrnnd_preinv((zz_digit_t)r, ni, dn, m->inv, &rl);
+            r = rl;
         }
-        if (u_size < v_size) {
-            SWAP(const zz_t *, u, v);
-            SWAP(zz_size_t, u_size, v_size);
+    }
+    return r >> s;
+}
+
+/* Return a*b/B^n mod m for reduced a and b, where n is the number of digits
+   of the odd m.  Or a*b mod B^2, if m is NULL. */
+static inline zz_dlimb_t
+zz_mod2_mul(zz_dlimb_t a, zz_dlimb_t b, const zz_mod2_t *m, bool two)
+{
+    if (!m) {
+        return a*b;
+    }
+
+    zz_digit_t m0 = (zz_digit_t)m->m, q;
+    zz_dlimb_t r;
+
+    if (!two) {
+        zz_dlimb_t p = a*b;
+
+        q = (zz_digit_t)p*m->minv;
+        r = (p >> ZZ_DIGIT_T_BITS) + ((zz_dlimb_t)q*m0 >> ZZ_DIGIT_T_BITS)
+            + ((zz_digit_t)p != 0);
+        return r >= m->m ? r - m->m : r;
+    }
+
+    zz_digit_t m1 = (zz_digit_t)(m->m >> ZZ_DIGIT_T_BITS);
+    zz_digit_t a0 = (zz_digit_t)a, a1 = (zz_digit_t)(a >> ZZ_DIGIT_T_BITS);
+    zz_digit_t b0 = (zz_digit_t)b, b1 = (zz_digit_t)(b >> ZZ_DIGIT_T_BITS);
+    zz_dlimb_t ll = (zz_dlimb_t)a0*b0, lh = (zz_dlimb_t)a0*b1;
+    zz_dlimb_t hl = (zz_dlimb_t)a1*b0, hh = (zz_dlimb_t)a1*b1;
+    zz_dlimb_t mid = (ll >> ZZ_DIGIT_T_BITS) + (zz_digit_t)lh + (zz_digit_t)hl;
+    zz_digit_t t0 = (zz_digit_t)ll, t1 = (zz_digit_t)mid;
+
+    hh += (lh >> ZZ_DIGIT_T_BITS) + (hl >> ZZ_DIGIT_T_BITS)
+          + (mid >> ZZ_DIGIT_T_BITS);
+
+    /* Add q*m*B^i to make the digit i of the product zero, i = 0, 1.  The
+       sum is less than 2*m*B^2 and might overflow four digits. */
+    q = t0*m->minv;
+
+    zz_dlimb_t c = ((zz_dlimb_t)q*m0 + t0) >> ZZ_DIGIT_T_BITS;
+
+    c += (zz_dlimb_t)q*m1 + t1;
+    t1 = (zz_digit_t)c;
+    r = hh + (c >> ZZ_DIGIT_T_BITS);
+
+    bool top = r < hh;
+
+    q = t1*m->minv;
+    c = ((zz_dlimb_t)q*m0 + t1) >> ZZ_DIGIT_T_BITS;
+    c += (zz_dlimb_t)q*m1 + (zz_digit_t)r;
+    hh = (r >> ZZ_DIGIT_T_BITS) + (c >> ZZ_DIGIT_T_BITS);
+    top |= (hh >> ZZ_DIGIT_T_BITS) != 0;
+    r = (hh << ZZ_DIGIT_T_BITS) | (zz_digit_t)c;
+    return top || r >= m->m ? r - m->m : r;
+}
+
+/* Return a^v for reduced a and positive v of given bit length, where the
+   multiplication is zz_mod2_mul().  The exponent is scanned from the most
+   significant bit by sliding windows with precomputed odd powers of the
+   base.  Arguments m and two are constant at call sites, so specialized
+   copies of this are compiled. */
+static inline zz_dlimb_t
+zz_mod2_pow(zz_dlimb_t a, const zz_t *v, zz_bitcnt_t bits, const zz_mod2_t *m,
+            bool two)
+{
+    unsigned int k = zz_mexp_window(bits);
+    zz_dlimb_t table[32] = {a}, r = a; /* odd powers a, ..., a^(2^k - 1) */
+
+    if (k > 1) {
+        zz_dlimb_t a2 = zz_mod2_mul(a, a, m, two);
+
+        for (size_t i = 1; i < (size_t)1 << (k - 1); i++) {
+            table[i] = zz_mod2_mul(table[i - 1], a2, m, two);
         }
-        if (ISNEG(u) && ISNEG(v)) {
-            if (!u_size) {
-                zz_clear(&o1);
-                zz_clear(&o2);
-                return zz_set_i64(0, w);
-            }
-            if (zz_resize(u_size, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(false, w);
-            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
-            if (v_size) {
-                mpn_xor_n(w->digits, u->digits, v->digits, v_size);
-            }
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
+    }
+
+    bool first = true;
+
+    for (int64_t i = (int64_t)bits - 1; i >= 0;) {
+        if (!zz_mexp_bit(v, i)) {
+            r = zz_mod2_mul(r, r, m, two);
+            i--;
+            continue;
         }
-        else if (ISNEG(u)) {
-            assert(v_size > 0);
-            if (u_size == ZZ_DIGITS_MAX) {
-                return ZZ_BUF; /* LCOV_EXCL_LINE */
-            }
-            if (zz_resize(u_size + 1, w)) {
-                goto err; /* LCOV_EXCL_LINE */
-            }
-            SETNEG(true, w);
-            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
-            mpn_xor_n(w->digits, v->digits, u->digits, v_size);
-            w->digits[u_size] = mpn_add_1(w->digits, w->digits, u_size, 1);
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
+
+        int64_t low = i + 1 >= k ? i + 1 - k : 0;
+        zz_digit_t val = 0;
+
+        while (!zz_mexp_bit(v, low)) {
+            low++;
         }
-        else {
-            assert(u_size > 0);
-            if (u_size == ZZ_DIGITS_MAX) {
-                return ZZ_BUF; /* LCOV_EXCL_LINE */
-            }
-            if (zz_resize(u_size + 1, w)) {
-                goto err; /* LCOV_EXCL_LINE */
+        for (int64_t b = i; b >= low; b--) {
+            val = (val << 1) | zz_mexp_bit(v, b);
+            if (!first) {
+                r = zz_mod2_mul(r, r, m, two);
             }
-            SETNEG(true, w);
-            mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
-            if (v_size) {
-                mpn_xor_n(w->digits, u->digits, v->digits, v_size);
-            }
-            w->digits[u_size] = mpn_add_1(w->digits, w->digits, u_size, 1);
-            zz_normalize(w);
-            zz_clear(&o1);
-            zz_clear(&o2);
-            return ZZ_OK;
         }
+        r = first ? table[val >> 1] : zz_mod2_mul(r, table[val >> 1], m, two);
+        first = false;
+        i = low - 1;
     }
-    if (u_size < v_size) {
-        SWAP(const zz_t *, u, v);
-        SWAP(zz_size_t, u_size, v_size);
+    return r;
+}
+
+static void
+zz_mod2_init(zz_dlimb_t mv, zz_mod2_t *m)
+{
+    m->m = mv;
+    m->two = (mv >> ZZ_DIGIT_T_BITS) != 0;
+
+    zz_digit_t top = (zz_digit_t)(m->two ? mv >> ZZ_DIGIT_T_BITS : mv);
+
+    m->shift = ZZ_DIGIT_T_BITS - (unsigned int)mpn_sizeinbase(&top, 1, 2);
+    m->d = mv << m->shift;
+    if (m->two) {
+        zz_digit_t dp[2] = {(zz_digit_t)m->d,
+                            (zz_digit_t)(m->d >> ZZ_DIGIT_T_BITS)};
+
+        m->inv = zz_invert_pi1(dp);
     }
-    if (zz_resize(u_size, w)) {
-        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    else {
+        zz_digit_t dn = (zz_digit_t)m->d;
+
+        m->inv = (zz_digit_t)((((zz_dlimb_t)~dn << ZZ_DIGIT_T_BITS)
+                               | ZZ_DIGIT_T_MAX) / dn);
     }
-    SETNEG(false, w);
-    mpn_xor_n(w->digits, u->digits, v->digits, v_size);
-    if (u_size != v_size) {
-        mpn_copyi(&w->digits[v_size], &u->digits[v_size], u_size - v_size);
+    m->minv = mv % 2 ? 0 - zz_binvert_digit((zz_digit_t)mv) : 0;
+}
+
+/* Return a^v mod m for the odd m, reduced nonzero a and positive v of
+   given bit length. */
+static zz_dlimb_t
+zz_mod2_powm_odd(zz_dlimb_t a, const zz_t *v, zz_bitcnt_t bits,
+                 const zz_mod2_t *m)
+{
+    zz_digit_t t[4] = {0, 0, (zz_digit_t)a,
+                       (zz_digit_t)(a >> ZZ_DIGIT_T_BITS)};
+
+    /* Convert to the Montgomery form, i.e. multiply by B^n, and back */
+    if (m->two) {
+        a = zz_mod2_pow(zz_mod2_rem(t, 4, m), v, bits, m, true);
+        return zz_mod2_mul(a, 1, m, true);
+    }
+    a = zz_mod2_pow(zz_mod2_rem(t + 1, 2, m), v, bits, m, false);
+    return zz_mod2_mul(a, 1, m, false);
+}
+
+/* Fast path of zz_powm() for moduli of one or two digits and nonnegative
+   exponents, that doesn't allocate memory (apart from the result).  Like
+   mpz_powm(), for even moduli m = 2^e*o results modulo o and 2^e are
+   combined by the CRT. */
+static zz_err
+zz_powm_small(const zz_t *u, const zz_t *v, const zz_t *w, zz_t *res)
+{
+    zz_dlimb_t mv = w->digits[0];
+    zz_mod2_t m;
+
+    if (w->size == 2) {
+        mv |= (zz_dlimb_t)w->digits[1] << ZZ_DIGIT_T_BITS;
+    }
+    zz_mod2_init(mv, &m);
+
+    zz_dlimb_t a = u->size ? zz_mod2_rem(u->digits, u->size, &m) : 0, r;
+    zz_bitcnt_t bits = zz_bitlen(v);
+
+    if (a && ISNEG(u)) {
+        a = mv - a;
+    }
+    if (mv == 1 || (!a && bits)) {
+        r = 0;
+    }
+    else if (!bits) {
+        r = 1;
+    }
+    else if (mv % 2) {
+        r = zz_mod2_powm_odd(a, v, bits, &m);
     }
     else {
-        zz_normalize(w);
+        zz_bitcnt_t e = zz_lsbpos(w);
+        zz_dlimb_t ov = mv >> e, mask = ((zz_dlimb_t)1 << e) - 1;
+
+        r = zz_mod2_pow(a, v, bits, NULL, false) & mask;
+        if (ov > 1) {
+            zz_digit_t t[2] = {(zz_digit_t)a,
+                               (zz_digit_t)(a >> ZZ_DIGIT_T_BITS)};
+            zz_dlimb_t oinv = zz_binvert_digit((zz_digit_t)ov), ro;
+
+            zz_mod2_init(ov, &m);
+            a = zz_mod2_rem(t, 2, &m);
+            ro = a ? zz_mod2_powm_odd(a, v, bits, &m) : 0;
+
+            /* Lift the inverse of ov modulo 2^e, then r = ro + ov*t, where
+               t = (r - ro)/ov mod 2^e. */
+            oinv *= 2 - ov*oinv;
+            r = ro + ov*(((r - ro)*oinv) & mask);
+        }
+    }
+
+    bool negative = ISNEG(w) && r;
+
+    if (negative) {
+        r = mv - r;
+    }
+    if (zz_resize(2, res)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
+    res->digits[0] = (zz_digit_t)r;
+    res->digits[1] = (zz_digit_t)(r >> ZZ_DIGIT_T_BITS);
+    SETNEG(negative, res);
+    zz_normalize(res);
     return ZZ_OK;
 }
+#endif
 
 zz_err
-zz_pow(const zz_t *u, uint64_t v, zz_t *w)
+zz_mod_pow(const zz_t *u, const zz_t *v, const zz_mod_ctx_t *ctx, zz_t *res)
 {
-    if (u == w) {
+    STATS_ENTER(ZZ_STATS_POWM);
+
+#if defined(__SIZEOF_INT128__)
+    if (ctx->m.size <= 2 && !ISNEG(v)) {
+        return zz_powm_small(u, v, &ctx->m, res);
+    }
+#endif
+
+    if (u == res) {
         zz_t tmp;
 
-        if (zz_init(&tmp) || zz_pos(u, &tmp)) {
-            /* LCOV_EXCL_START */
-            zz_clear(&tmp);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
+        if (zz_save(res, &tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
         }
 
-        zz_err ret = zz_pow(&tmp, v, w);
+        zz_err ret = zz_mod_pow(&tmp, v == u ? &tmp : v, ctx, res);
 
         zz_clear(&tmp);
         return ret;
     }
-    if (!v) {
-        return zz_set_i64(1, w);
-    }
-    if (!u->size) {
-        return zz_set_i64(0, w);
-    }
-    if (zz_cmp_i64(u, 1) == ZZ_EQ) {
-        return zz_set_i64(1, w);
-    }
-    if (v > ZZ_DIGITS_MAX / u->size) {
-        return ZZ_BUF;
+    if (v == res) {
+        zz_t tmp;
+
+        if (zz_save(res, &tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+
+        zz_err ret = zz_mod_pow(u, &tmp, ctx, res);
+
+        zz_clear(&tmp);
+        return ret;
     }
 
-    zz_size_t w_size = (zz_size_t)(v * (zz_digit_t)u->size);
-    zz_digit_t *tmp = malloc((size_t)w_size * ZZ_DIGIT_T_BYTES);
+    const zz_t *w = &ctx->m;
+    zz_t o1, o2;
+    zz_err ret = ZZ_OK;
 
-    if (!tmp || zz_resize(w_size, w)) {
+    if (zz_init(&o1) || zz_init(&o2)) {
         /* LCOV_EXCL_START */
-        free(tmp);
-        zz_clear(w);
-        return ZZ_MEM;
+        ret = ZZ_MEM;
+        goto end;
         /* LCOV_EXCL_STOP */
     }
-    SETNEG(ISNEG(u) && v%2, w);
-    w->size = (zz_size_t)mpn_pow_1(w->digits, u->digits, u->size, v, tmp);
-    free(tmp);
-    if (zz_resize(w->size, w)) {
-        /* LCOV_EXCL_START */
-        zz_clear(w);
-        return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
+    if (ISNEG(v)) {
+        if (zz_neg(v, &o2)) {
+            /* LCOV_EXCL_START */
+            ret = ZZ_MEM;
+            goto end;
+            /* LCOV_EXCL_STOP */
+        }
+        v = &o2;
+        if ((ret = zz_inverse(u, w, &o1))) {
+            goto end;
+        }
+        u = &o1;
     }
-    return ZZ_OK;
+    if (ISNEG(u) || u->size > w->size) {
+        if ((ret = zz_mod_ctx_rem(u->digits, u->size, ISNEG(u), ctx, &o1))) {
+            goto end; /* LCOV_EXCL_LINE */
+        }
+        u = &o1;
+    }
+    if (zz_cmp_i64(w, 1) == ZZ_EQ) {
+        ret = zz_set_i64(0, res);
+    }
+    else if (!v->size) {
+        ret = zz_set_i64(1, res);
+    }
+    else if (!u->size) {
+        ret = zz_set_i64(0, res);
+    }
+    else if (zz_cmp_i64(u, 1) == ZZ_EQ) {
+        ret = zz_set_i64(1, res);
+    }
+    else {
+        ret = _zz_powm(u, v, ctx, res);
+    }
+end:
+    zz_clear(&o1);
+    zz_clear(&o2);
+    return ret;
 }
 
-static zz_err
-zz_gcd(const zz_t *u, const zz_t *v, zz_t *w)
+/* Multi-exponentiation: powers of all bases share one chain of squarings.
+   Exponents are scanned from the most significant bit by sliding windows
+   (with precomputed odd powers of bases), that are interleaved: each base
+   multiplies the accumulator at the position of the lowest bit of it's
+   current window.  Residues are kept as arrays of n digits, for odd moduli
+   (if not too big) - in the Montgomery form. */
+
+typedef struct {
+    const zz_t *e;
+    zz_digit_t *table;  /* odd powers u, u^3, ..., u^(2^k - 1) */
+    int64_t pos;        /* position of the next window, or -1 */
+    zz_digit_t val;
+    unsigned int k;
+} zz_mexp_t;
+
+/* Below this size of odd moduli, Montgomery reduction is used */
+#define MEXP_REDC_MAX_DIGITS 64
+
+/* Find the window with the highest set bit at or below the position top. */
+static void
+zz_mexp_next(zz_mexp_t *s, int64_t top)
 {
-    if (u->size < v->size) {
-        SWAP(const zz_t *, u, v);
+    while (top >= 0 && !zz_mexp_bit(s->e, top)) {
+        top--;
     }
-    if (!v->size) {
-        return zz_abs(u, w);
+    if (top < 0) {
+        s->pos = -1;
+        return;
     }
 
-    zz_bitcnt_t shift = MIN(zz_lsbpos(u), zz_lsbpos(v));
-    zz_t *volatile o1 = malloc(sizeof(zz_t));
-    zz_t *volatile o2 = malloc(sizeof(zz_t));
+    int64_t low = MAX(top - (int64_t)s->k + 1, 0);
 
-    if (!o1 || !o2) {
-        goto free; /* LCOV_EXCL_LINE */
+    while (!zz_mexp_bit(s->e, low)) {
+        low++;
     }
-    if (zz_init(o1) || zz_init(o2) || zz_abs(u, o1) || zz_abs(v, o2)) {
-        goto clear; /* LCOV_EXCL_LINE */
+    s->val = 0;
+    for (int64_t b = top; b >= low; b--) {
+        s->val = (s->val << 1) | zz_mexp_bit(s->e, b);
     }
-    if (shift && (zz_quo_2exp(o1, shift, o1) || zz_quo_2exp(o2, shift, o2))) {
-        goto clear; /* LCOV_EXCL_LINE */
+    s->pos = low;
+}
+
+/* Set {rp, n} to the product of residues {ap, n} and {bp, n}: in the
+   Montgomery form, if invm is nonzero.  Uses 3n + 2 digits at tp. */
+static void
+zz_mexp_mul(const zz_mod_ctx_t *ctx, zz_digit_t invm, zz_digit_t *rp,
+            const zz_digit_t *ap, const zz_digit_t *bp, zz_digit_t *tp)
+{
+    const zz_t *m = &ctx->m;
+    zz_size_t n = m->size;
+
+    if (ap == bp) {
+        mpn_sqr(tp, ap, n);
     }
-    u = o1;
-    v = o2;
-    assert(v->size);
-    if (zz_resize(v->size, w) || TMP_OVERFLOW) {
-        goto clear; /* LCOV_EXCL_LINE */
+    else {
+        mpn_mul_n(tp, ap, bp, n);
     }
-    if (v->size == 1) {
-        w->digits[0] = mpn_gcd_1(u->digits, u->size, v->digits[0]);
+    if (invm) {
+        if (mpn_redc_1(rp, tp, m->digits, n, invm)) {
+            mpn_sub_n(rp, rp, m->digits, n);
+        }
     }
     else {
-        w->size = (zz_size_t)mpn_gcd(w->digits, u->digits, u->size, v->digits,
-                                     v->size);
+        zz_mod_ctx_divrem(ctx, tp, 2*n, tp + 2*n + 1);
+        mpn_copyi(rp, tp, n);
     }
-    SETNEG(false, w);
-    zz_clear(o1);
-    zz_clear(o2);
-    free(o1);
-    free(o2);
-    return zz_mul_2exp(w, shift, w);
-    /* LCOV_EXCL_START */
-clear:
-    zz_clear(o1);
-    zz_clear(o2);
-free:
-    free(o1);
-    free(o2);
-    return ZZ_MEM;
-    /* LCOV_EXCL_STOP */
 }
 
 zz_err
-zz_inverse_euclidext(const zz_t *u, const zz_t *v, zz_t *t)
+zz_mod_pow_multi(const zz_t *const *u, const zz_t *const *v, size_t n,
+                 const zz_mod_ctx_t *ctx, zz_t *w)
 {
-    zz_t r, newt, newr, q, t1, t2;
-    bool u_neg = ISNEG(u);
+    STATS_ENTER(ZZ_STATS_POWM);
 
-    if (zz_init(&r) || zz_init(&newt) || zz_init(&newr)
-        || zz_init(&q) || zz_init(&t1) || zz_init(&t2)
-        || zz_pos(v, &r) || zz_set_i32(1, &newt)
-        || zz_pos(u, &newr) || zz_set_i32(0, t))
-    {
-        /* LCOV_EXCL_START */
-clear2:
-        zz_clear(&r);
-        zz_clear(&newt);
-        zz_clear(&newr);
-        zz_clear(&q);
-        zz_clear(&t1);
-        zz_clear(&t2);
-        return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
+    const zz_t *m = &ctx->m;
+    zz_size_t mn = m->size;
+    size_t ntab = 0;
+    zz_bitcnt_t bits = 0;
+    zz_digit_t invm = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        zz_bitcnt_t b = zz_bitlen(v[i]);
+
+        bits = MAX(bits, b);
+        ntab += (size_t)1 << (zz_mexp_window(b) - 1);
     }
-    while (zz_cmp_i64(&newr, 0) != ZZ_EQ) {
-        if (zz_div(&r, &newr, &q, NULL)) {
-            goto clear2; /* LCOV_EXCL_LINE */
+    if (m->digits[0] % 2 && mn < MEXP_REDC_MAX_DIGITS) {
+        invm = 0 - zz_binvert_digit(m->digits[0]);
+    }
+
+    /* Tables, the accumulator and scratch space for zz_mexp_mul() */
+    zz_mexp_t *st = TMP_ALLOC(n * sizeof(zz_mexp_t)
+                              + ((ntab + 4)*(size_t)mn + 2)
+                                * ZZ_DIGIT_T_BYTES);
+
+    if (!st) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+
+    zz_digit_t *tab = (zz_digit_t *)(st + n), *acc = tab + ntab*(size_t)mn;
+    zz_digit_t *tp = acc + mn;
+    zz_err ret = ZZ_OK;
+    zz_t g;
+
+    (void)zz_init(&g);
+    for (size_t i = 0, j = 0; i < n; i++) {
+        zz_bitcnt_t b = zz_bitlen(v[i]);
+        zz_mexp_t *s = &st[i];
+
+        s->e = v[i];
+        s->k = zz_mexp_window(b);
+        s->table = tab + j*(size_t)mn;
+        j += (size_t)1 << (s->k - 1);
+        zz_mexp_next(s, (int64_t)b - 1);
+        if (s->pos < 0) {
+            continue;
         }
-        if (zz_pos(&newt, &t1) || zz_mul(&q, &newt, &t2)
-            || zz_sub(t, &t2, &newt) || zz_pos(&t1, t))
-        {
-            goto clear2; /* LCOV_EXCL_LINE */
+        /* Negative exponents require the inverse of the base. */
+        if (ISNEG(v[i])) {
+            if ((ret = zz_inverse(u[i], m, &g))
+                || (ret = zz_mod_reduce(&g, ctx, &g)))
+            {
+                goto end;
+            }
         }
-        if (zz_pos(&newr, &t1) || zz_mul(&q, &newr, &t2)
-            || zz_sub(&r, &t2, &newr) || zz_pos(&t1, &r))
-        {
-            goto clear2; /* LCOV_EXCL_LINE */
+        else if ((ret = zz_mod_reduce(u[i], ctx, &g))) {
+            goto end; /* LCOV_EXCL_LINE */
         }
+        mpn_copyi(s->table, g.digits, g.size);
+        mpn_zero(s->table + g.size, mn - g.size);
     }
-    zz_clear(&newt);
-    zz_clear(&newr);
-    zz_clear(&q);
-    zz_clear(&t1);
-    zz_clear(&t2);
-    if (t->size) {
-        SETNEG(ISNEG(t) != u_neg, t);
-    }
-    (void)zz_abs(&r, &r);
-    if (zz_cmp_i64(&r, 1) != ZZ_EQ) {
-        zz_clear(&r);
-        return ZZ_VAL;
+    if (TMP_OVERFLOW) {
+        /* LCOV_EXCL_START */
+        ret = ZZ_MEM;
+        goto end;
+        /* LCOV_EXCL_STOP */
     }
-    zz_clear(&r);
-    return ZZ_OK;
-}
+    for (size_t i = 0; i < n; i++) {
+        zz_mexp_t *s = &st[i];
 
-zz_err
-zz_gcdext(const zz_t *u, const zz_t *v, zz_t *g, zz_t *s, zz_t *t)
-{
-    if (!s && !t) {
-        if (!g) {
-            return ZZ_OK;
+        if (s->pos < 0) {
+            continue;
         }
-        return zz_gcd(u, v, g);
-    }
-    if (u->size < v->size) {
-        SWAP(const zz_t *, u, v);
-        SWAP(zz_t *, s, t);
-    }
-    if (!v->size) {
-        if (g) {
-            if (zz_abs(u, g)) {
-                return ZZ_MEM; /* LCOV_EXCL_LINE */
-            }
+        if (invm) {
+            /* Convert to the Montgomery form: u*B^mn mod m */
+            mpn_zero(tp, mn);
+            mpn_copyi(tp + mn, s->table, mn);
+            zz_mod_ctx_divrem(ctx, tp, 2*mn, tp + 2*mn + 1);
+            mpn_copyi(s->table, tp, mn);
         }
-        if (s) {
-            if (zz_set_i64(ISNEG(u) ? -1 : 1, s)) {
-                return ZZ_MEM; /* LCOV_EXCL_LINE */
+        if (s->k > 1) {
+            zz_mexp_mul(ctx, invm, acc, s->table, s->table, tp);
+            for (size_t t = 1; t < (size_t)1 << (s->k - 1); t++) {
+                zz_mexp_mul(ctx, invm, s->table + t*(size_t)mn,
+                            s->table + (t - 1)*(size_t)mn, acc, tp);
             }
-            s->size = u->size > 0; /* make 0 if u == 0 */
         }
-        if (t) {
-            t->size = 0;
-            SETNEG(false, t);
-        }
-        return ZZ_OK;
     }
 
-    zz_t *volatile o1 = malloc(sizeof(zz_t));
-    zz_t *volatile o2 = malloc(sizeof(zz_t));
-    zz_t *volatile tmp_g = malloc(sizeof(zz_t));
-    zz_t *volatile tmp_s = malloc(sizeof(zz_t));
-    /* v->size + 1 can be > ZZ_DIGITS_MAX, but it should
-       not overflow zz_size_t type */
-    zz_digit_t *volatile tmp_s_digits = malloc(ZZ_DIGIT_T_BYTES
-                                               * (size_t)(v->size + 1));
+    bool one = true;
 
-    if (!o1 || !o2 || !tmp_g || !tmp_s || !tmp_s_digits) {
-        goto free; /* LCOV_EXCL_LINE */
-    }
-    if (zz_init(o1) || zz_init(o2)
-        || zz_init(tmp_g) || zz_init(tmp_s)
-        || zz_pos(u, o1) || zz_pos(v, o2)
-        || zz_resize(v->size, tmp_g)
-        || TMP_OVERFLOW)
-    {
-        goto clear; /* LCOV_EXCL_LINE */
-    }
+    for (int64_t b = (int64_t)bits - 1; b >= 0; b--) {
+        if (!one) {
+            zz_mexp_mul(ctx, invm, acc, acc, acc, tp);
+        }
+        for (size_t i = 0; i < n; i++) {
+            zz_mexp_t *s = &st[i];
 
-    mp_size_t ssize;
+            if (s->pos != b) {
+                continue;
+            }
 
-    tmp_g->size = (zz_size_t)mpn_gcdext(tmp_g->digits, tmp_s_digits, &ssize,
-                                        o1->digits, u->size, o2->digits,
-                                        v->size);
-    SETNEG(false, tmp_g);
-    /* Now s either 1 or |s| < v/(2g) */
-    if (zz_resize(labs(ssize), tmp_s)) {
-        goto clear; /* LCOV_EXCL_LINE */
-    }
-    mpn_copyi(tmp_s->digits, tmp_s_digits, tmp_s->size);
-    SETNEG((ISNEG(u) && ssize > 0) || (!ISNEG(u) && ssize < 0), tmp_s);
-    free(tmp_s_digits);
-    tmp_s_digits = NULL;
-    if (t) {
-        /* Use t = (g - u*s)/v, if no integer overflow is possible,
-           else compute t by Extended Euclidean algorithm */
-        if (MAX(u->size + tmp_s->size, tmp_g->size) < ZZ_DIGITS_MAX) {
-            if (zz_mul(u, tmp_s, o2) || zz_sub(tmp_g, o2, o2)
-                || zz_div(o2, v, t, NULL))
-            {
-                goto clear; /* LCOV_EXCL_LINE */
+            const zz_digit_t *p = s->table + (s->val >> 1)*(size_t)mn;
+
+            if (one) {
+                mpn_copyi(acc, p, mn);
+                one = false;
             }
-        }
-        else {
-            /* LCOV_EXCL_START */
-            if (zz_div(u, tmp_g, o1, NULL) || zz_div(v, tmp_g, o2, NULL)
-                || zz_inverse_euclidext(o2, o1, t))
-            {
-                goto clear;
+            else {
+                zz_mexp_mul(ctx, invm, acc, acc, p, tp);
             }
-            /* LCOV_EXCL_STOP */
+            zz_mexp_next(s, b - 1);
         }
     }
-    zz_clear(o1);
-    zz_clear(o2);
-    free(o1);
-    free(o2);
-    o1 = NULL;
-    o2 = NULL;
-    if (s && zz_pos(tmp_s, s)) {
-        goto clear; /* LCOV_EXCL_LINE */
-    }
-    if (g && zz_pos(tmp_g, g)) {
-        goto clear; /* LCOV_EXCL_LINE */
+    if (one) {
+        ret = zz_set_i32(zz_cmp_i64(m, 1) != ZZ_EQ, w);
+        goto end;
     }
-    zz_clear(tmp_s);
-    zz_clear(tmp_g);
-    free(tmp_g);
-    free(tmp_s);
-    return ZZ_OK;
-    /* LCOV_EXCL_START */
-clear:
-    zz_clear(o1);
-    zz_clear(o2);
-    zz_clear(tmp_g);
-    zz_clear(tmp_s);
-free:
-    free(o1);
-    free(o2);
-    free(tmp_g);
-    free(tmp_s);
-    free(tmp_s_digits);
-    return ZZ_MEM;
-    /* LCOV_EXCL_STOP */
-}
-
-static zz_err
-zz_inverse(const zz_t *u, const zz_t *v, zz_t *w)
-{
-    zz_t g;
-
-    if (zz_init(&g) || zz_gcdext(u, v, &g, w, NULL)) {
-        /* LCOV_EXCL_START */
-        zz_clear(&g);
-        return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
+    if (invm) {
+        /* Convert back from the Montgomery form */
+        mpn_copyi(tp, acc, mn);
+        mpn_zero(tp + mn, mn);
+        if (mpn_redc_1(acc, tp, m->digits, mn, invm)
+            || mpn_cmp(acc, m->digits, mn) >= 0)
+        {
+            mpn_sub_n(acc, acc, m->digits, mn);
+        }
     }
-    if (zz_cmp_i64(&g, 1) == ZZ_EQ) {
-        zz_clear(&g);
-        return ZZ_OK;
+    if ((ret = zz_resize(mn, w))) {
+        goto end; /* LCOV_EXCL_LINE */
     }
+    mpn_copyi(w->digits, acc, mn);
+    SETNEG(false, w);
+    zz_normalize(w);
+end:
     zz_clear(&g);
-    return ZZ_VAL;
+    TMP_FREE(st);
+    return ret;
 }
 
+/* Fixed-base exponentiation, see zz_powm_table_init().  The exponent is
+   split to k-bit digits e_i, then u^e = prod (prod_{e_i=j} g_i)^j, where
+   g_i = u^(2^(k*i)) are precomputed.  Inner products are accumulated for
+   j in decreasing order (Brickell, Gordon, McCurley and Wilson), that
+   requires one multiplication per digit plus one per value of j. */
+
+#define POWM_TABLE_MAX_WINDOW 16
+
 zz_err
-zz_lcm(const zz_t *u, const zz_t *v, zz_t *w)
+zz_powm_table_init(zz_powm_table_t *t, const zz_t *u, const zz_mod_ctx_t *ctx,
+                   zz_bitcnt_t bits, unsigned int window)
 {
-    zz_t g;
-    zz_err ret = ZZ_MEM;
-
-    if (zz_init(&g) || zz_gcd(u, v, &g)) {
-        goto end; /* LCOV_EXCL_LINE */
-    }
-    if (zz_iszero(&g)) {
-        zz_clear(&g);
-        return zz_set_i64(0, w);
+    if (window > POWM_TABLE_MAX_WINDOW) {
+        return ZZ_VAL;
     }
-    if (zz_div(u, &g, &g, NULL)) {
-        goto end; /* LCOV_EXCL_LINE */
+    bits = MAX(bits, 1);
+    if (!window) {
+        /* Minimize the number of multiplications, bits/k + 2^k. */
+        window = 1;
+        while (window < POWM_TABLE_MAX_WINDOW
+               && ((bits + window)/(window + 1) + ((zz_bitcnt_t)2 << window)
+                   < (bits + window - 1)/window + ((zz_bitcnt_t)1 << window)))
+        {
+            window++;
+        }
     }
-    ret = zz_mul(&g, v, w);
-end:
-    zz_clear(&g);
-    (void)zz_abs(w, w);
-    return ret;
-}
 
-static zz_err
-_zz_powm(const zz_t *u, const zz_t *v, const zz_t *w, zz_t *res)
-{
-    if (zz_resize(w->size, res)) {
+    zz_bitcnt_t size = (bits + window - 1)/window;
+
+    if (size > SIZE_MAX/sizeof(zz_t)) {
+        return ZZ_BUF; /* LCOV_EXCL_LINE */
+    }
+    if (zz_over_budget((double)size * (double)ctx->m.size)) {
+        return ZZ_LIM;
+    }
+    t->table = zz_state.malloc((size_t)size * sizeof(zz_t));
+    if (!t->table) {
         return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
-    SETNEG(false, res);
-    /* Handle (u**1 mod w) early, since mpn_pow* can't */
-    if (zz_cmp_i64(v, 1) == ZZ_EQ) {
-        if (zz_div(u, w, NULL, res)) {
-            return ZZ_MEM; /* LCOV_EXCL_LINE */
+    t->ctx = ctx;
+    t->size = (size_t)size;
+    t->bits = size*window;
+    t->window = window;
+    for (size_t i = 0; i < t->size; i++) {
+        (void)zz_init(&t->table[i]);
+    }
+
+    zz_err ret = zz_mod_reduce(u, ctx, &t->table[0]);
+
+    for (size_t i = 1; !ret && i < t->size; i++) {
+        ret = zz_mod_sqr(&t->table[i - 1], ctx, &t->table[i]);
+        for (unsigned int k = 1; !ret && k < window; k++) {
+            ret = zz_mod_sqr(&t->table[i], ctx, &t->table[i]);
         }
-        return ZZ_OK;
     }
+    if (ret) {
+        /* LCOV_EXCL_START */
+        zz_powm_table_clear(t);
+        return ret;
+        /* LCOV_EXCL_STOP */
+    }
+    return ZZ_OK;
+}
+
+void
+zz_powm_table_clear(zz_powm_table_t *t)
+{
+    for (size_t i = 0; i < t->size; i++) {
+        zz_clear(&t->table[i]);
+    }
+    zz_state.free(t->table, t->size * sizeof(zz_t));
+    t->table = NULL;
+    t->size = 0;
+}
 
-    zz_bitcnt_t lsbpos = zz_lsbpos(w);
-    zz_size_t n = w->size;
-    zz_t t1;
+zz_err
+zz_powm_table(const zz_powm_table_t *t, const zz_t *v, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_POWM);
 
-    zz_init(&t1);
-    if (lsbpos) {
-        if (zz_quo_2exp(w, lsbpos, &t1)) {
-            /* LCOV_EXCL_START */
-            zz_clear(&t1);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
-        }
-        w = &t1;
+    zz_bitcnt_t v_bits = zz_bitlen(v);
+
+    if (ISNEG(v) || !v_bits || v_bits > t->bits) {
+        return zz_mod_pow(&t->table[0], v, t->ctx, w);
     }
 
-    zz_size_t nodd = w->size;
-    zz_size_t neven = (zz_size_t)(lsbpos + ZZ_DIGIT_T_BITS - 1)/ZZ_DIGIT_T_BITS;
-    zz_size_t cnt = lsbpos % ZZ_DIGIT_T_BITS;
-    zz_size_t n_largest_binvert = MAX(neven, nodd);
-    zz_size_t itch_binvert = mpn_binvert_itch(n_largest_binvert);
-    zz_size_t itch = n + MAX(itch_binvert, 2*n);
+    unsigned int k = t->window;
+    size_t nvals = (size_t)1 << k, ndigits = (size_t)((v_bits + k - 1)/k);
+    /* Digits are grouped by value in linked lists: head[j] is the first
+       index (plus one) with the value j and next[i] - the following one. */
+    size_t *head = TMP_ALLOC((nvals + ndigits) * sizeof(size_t));
 
-    /* Now w factored as w * BASE**neven */
-    if (neven != 0) {
-        /* We will call both mpn_powm() and mpn_powlo() */
-        itch += 2*n;
+    if (!head) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
 
-    zz_digit_t *volatile tp = malloc((size_t)itch * sizeof(zz_digit_t));
-    zz_digit_t *volatile newup = NULL;
-    zz_digit_t *volatile newwp = NULL;
-    zz_digit_t *volatile rp = tp;
+    size_t *next = head + nvals;
 
-    if (!tp || TMP_OVERFLOW) {
-        /* LCOV_EXCL_START */
-clear:
-        free(rp);
-        free(newup);
-        free(newwp);
-        zz_clear(&t1);
-        zz_clear(res);
-        return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
+    memset(head, 0, nvals * sizeof(size_t));
+    for (size_t i = ndigits; i-- > 0;) {
+        zz_bitcnt_t pos = (zz_bitcnt_t)i*k;
+        zz_size_t j = (zz_size_t)(pos / ZZ_DIGIT_T_BITS);
+        unsigned int s = (unsigned int)(pos % ZZ_DIGIT_T_BITS);
+        zz_digit_t e = v->digits[j] >> s;
+
+        if (s + k > ZZ_DIGIT_T_BITS && j + 1 < v->size) {
+            e |= v->digits[j + 1] << (ZZ_DIGIT_T_BITS - s);
+        }
+        e &= nvals - 1;
+        next[i] = head[e];
+        head[e] = i + 1;
     }
-    tp += n;
-    /* Compute r = u**v mod w */
-    mpn_powm (rp, u->digits, u->size, v->digits, v->size,
-              w->digits, nodd, tp);
-    if (neven != 0) {
-        zz_digit_t *r2, *xp, *yp, *odd_inv_2exp, *up, *wp;
 
-        if (u->size < neven) {
-            /* Padd u with zeros. */
-            newup = malloc((size_t)neven * sizeof(zz_digit_t));
-            if (!newup) {
-                goto clear; /* LCOV_EXCL_LINE */
+    zz_t a, b;
+    bool a_one = true, b_one = true;
+    zz_err ret = ZZ_OK;
+
+    (void)zz_init(&a);
+    (void)zz_init(&b);
+    for (size_t e = nvals - 1; e > 0; e--) {
+        for (size_t i = head[e]; i && !ret; i = next[i - 1]) {
+            if (b_one) {
+                ret = zz_pos(&t->table[i - 1], &b);
+                b_one = false;
             }
-            mpn_copyi(newup, u->digits, u->size);
-            mpn_zero(newup + u->size, neven - u->size);
-            up = newup;
-        }
-        else {
-            up = u->digits;
-        }
-        r2 = tp;
-        if (up[0] % 2 == 0) {
-            if (v->size > 1) {
-                mpn_zero(r2, neven);
-                goto zero;
+            else {
+                ret = zz_mod_mul(&b, &t->table[i - 1], t->ctx, &b);
             }
         }
-        /* Compute r2 = u**v mod BASE**neven */
-        mpn_powlo(r2, up, v->digits, v->size, neven, tp + neven);
-zero:
-        free(newup);
-        if (nodd < neven) {
-            /* Padd w with zeros */
-            newwp = malloc((size_t)neven * sizeof(zz_digit_t));
-            if (!newwp) {
-                goto clear; /* LCOV_EXCL_LINE */
+        if (!b_one && !ret) {
+            if (a_one) {
+                ret = zz_pos(&b, &a);
+                a_one = false;
+            }
+            else {
+                ret = zz_mod_mul(&a, &b, t->ctx, &a);
             }
-            mpn_copyi(newwp, w->digits, nodd);
-            mpn_zero(newwp + nodd, neven - nodd);
-            wp = newwp;
-            zz_clear(&t1);
-        }
-        else {
-            wp = w->digits;
-        }
-        odd_inv_2exp = tp + n;
-        /* odd_inv_2exp = w**(-1) mod BASE**neven */
-        mpn_binvert(odd_inv_2exp, wp, neven, tp + 2*n);
-        /* r2 = r2 - r */
-        mpn_sub(r2, r2, neven, rp, MIN(nodd, neven));
-        xp = tp + 2*n;
-        /* x = (odd_inv_2exp * r2) mod BASE**neven */
-        mpn_mullo_n(xp, odd_inv_2exp, r2, neven);
-        if (cnt) {
-            xp[neven - 1] &= ((mp_limb_t)1 << cnt) - 1;
-        }
-        yp = tp;
-        if (neven > nodd) {
-            mpn_mul(yp, xp, neven, wp, nodd);
-        }
-        else {
-            mpn_mul(yp, wp, nodd, xp, neven);
         }
-        free(newwp);
-        /* r += x * w */
-        mpn_add(rp, yp, n, rp, nodd);
     }
-    zz_clear(&t1);
-    if (zz_resize(n, res)) {
-        /* LCOV_EXCL_START */
-        free(rp);
-        zz_clear(res);
-        return ZZ_MEM;
-        /* LCOV_EXCL_STOP */
+    TMP_FREE(head);
+    if (!ret) {
+        ret = zz_pos(&a, w);
     }
-    mpn_copyi(res->digits, rp, n);
-    free(rp);
-    zz_normalize(res);
-    return ZZ_OK;
+    zz_clear(&a);
+    zz_clear(&b);
+    return ret;
 }
 
 zz_err
 zz_powm(const zz_t *u, const zz_t *v, const zz_t *w, zz_t *res)
 {
+    STATS_ENTER(ZZ_STATS_POWM);
+
     if (!w->size) {
         return ZZ_VAL;
     }
-    if (u == res) {
+#if defined(__SIZEOF_INT128__)
+    if (w->size <= 2 && !ISNEG(v)) {
+        return zz_powm_small(u, v, w, res);
+    }
+#endif
+    if (w == res) {
         zz_t tmp;
 
-        if (zz_init(&tmp) || zz_pos(u, &tmp)) {
-            /* LCOV_EXCL_START */
-            zz_clear(&tmp);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
+        if (zz_save(res, &tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
         }
 
-        zz_err ret = zz_powm(&tmp, v, w, res);
+        zz_err ret = zz_powm(u == w ? &tmp : u, v == w ? &tmp : v, &tmp, res);
 
         zz_clear(&tmp);
         return ret;
     }
-    if (v == res) {
-        zz_t tmp;
 
-        if (zz_init(&tmp) || zz_pos(v, &tmp)) {
-            /* LCOV_EXCL_START */
-            zz_clear(&tmp);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
-        }
+    /* Temporary context for the modulus |w|, that doesn't copy it and
+       doesn't precompute the inverse for reduction. */
+    zz_mod_ctx_t ctx = {.m = ZZ_CONST_INIT(false, w->size, w->digits)};
+    zz_err ret = ZZ_MEM;
+
+    if (zz_init(&ctx.norm) || zz_init(&ctx.odd) || zz_init(&ctx.inv)
+        || zz_mod_ctx_prepare(&ctx, false))
+    {
+        goto end; /* LCOV_EXCL_LINE */
+    }
+    ret = zz_mod_pow(u, v, &ctx, res);
+    if (ISNEG(w) && !ret && res->size && zz_sub(res, &ctx.m, res)) {
+        ret = ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+end:
+    zz_clear(&ctx.norm);
+    zz_clear(&ctx.odd);
+    zz_clear(&ctx.inv);
+    return ret;
+}
 
-        zz_err ret = zz_powm(u, &tmp, w, res);
+/* Set {rp, n} to u mod B^n (two's complement for negative u). */
+static void
+zz_get_2exp(const zz_t *u, zz_size_t n, zz_digit_t *rp)
+{
+    zz_size_t un = MIN(u->size, n);
 
-        zz_clear(&tmp);
-        return ret;
+    mpn_copyi(rp, u->digits, un);
+    mpn_zero(rp + un, n - un);
+    if (ISNEG(u)) {
+        (void)mpn_neg(rp, rp, n);
     }
-    if (w == res) {
-        zz_t tmp;
+}
 
-        if (zz_init(&tmp) || zz_pos(w, &tmp)) {
-            /* LCOV_EXCL_START */
-            zz_clear(&tmp);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
-        }
+/* Set w (of n digits) to {rp, n} mod 2^k. */
+static void
+zz_set_2exp(const zz_digit_t *rp, zz_size_t n, zz_bitcnt_t k, zz_t *w)
+{
+    mpn_copyi(w->digits, rp, n);
+    if (k % ZZ_DIGIT_T_BITS) {
+        w->digits[n - 1] &= ((zz_digit_t)1 << k % ZZ_DIGIT_T_BITS) - 1;
+    }
+    w->size = n;
+    SETNEG(false, w);
+    zz_normalize(w);
+}
 
-        zz_err ret = zz_powm(u, v, &tmp, res);
+zz_err
+zz_invert_2exp(const zz_t *u, zz_bitcnt_t k, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_GCD);
 
-        zz_clear(&tmp);
-        return ret;
+    if (!k) {
+        return zz_set_i64(0, w);
+    }
+    if (!u->size || u->digits[0] % 2 == 0) {
+        return ZZ_VAL;
+    }
+    if (k > ZZ_BITS_MAX - ZZ_DIGIT_T_BITS) {
+        return ZZ_BUF;
     }
 
-    int negativeOutput = 0;
-    zz_t o1, o2, o3;
-    zz_err ret = ZZ_OK;
+    zz_size_t n = (zz_size_t)((k + ZZ_DIGIT_T_BITS - 1)/ZZ_DIGIT_T_BITS);
+    zz_size_t itch = (zz_size_t)mpn_binvert_itch(n);
+
+    /* The result, the argument and scratch space of mpn_binvert() */
+    if (zz_over_budget(2*(double)n + (double)itch)) {
+        return ZZ_LIM;
+    }
+
+    zz_digit_t *volatile tp = TMP_ALLOC((size_t)(2*n + itch)
+                                        * ZZ_DIGIT_T_BYTES);
 
-    if (zz_init(&o1) || zz_init(&o2) || zz_init(&o3)) {
+    if (!tp || TMP_OVERFLOW) {
         /* LCOV_EXCL_START */
-        zz_clear(&o1);
-        zz_clear(&o2);
-        zz_clear(&o3);
+err:
+        TMP_FREE(tp);
+        zz_clear(w);
         return ZZ_MEM;
         /* LCOV_EXCL_STOP */
     }
-    if (ISNEG(w)) {
-        if (zz_pos(w, &o3)) {
-            goto end; /* LCOV_EXCL_LINE */
-        }
-        negativeOutput = 1;
-        SETNEG(false, &o3);
-        w = &o3;
+    zz_get_2exp(u, n, tp);
+    mpn_binvert(tp + n, tp, n, tp + 2*n);
+    if (zz_resize(n, w)) {
+        goto err; /* LCOV_EXCL_LINE */
+    }
+    zz_set_2exp(tp + n, n, k, w);
+    TMP_FREE(tp);
+    return ZZ_OK;
+}
+
+zz_err
+zz_powm_2exp(const zz_t *u, const zz_t *v, zz_bitcnt_t k, zz_t *w)
+{
+    STATS_ENTER(ZZ_STATS_POWM);
+
+    if (!k) {
+        return zz_set_i64(0, w);
     }
     if (ISNEG(v)) {
-        if (zz_pos(v, &o2)) {
-            goto end; /* LCOV_EXCL_LINE */
-        }
-        SETNEG(false, &o2);
-        v = &o2;
+        /* u^v = (1/u)^|v| */
+        zz_t inv;
 
-        if ((ret = zz_inverse(u, w, &o1)) == ZZ_MEM) {
-            goto end; /* LCOV_EXCL_LINE */
+        if (zz_init(&inv)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
         }
-        if (ret == ZZ_VAL) {
-end:
-            zz_clear(&o1);
-            zz_clear(&o2);
-            zz_clear(&o3);
-            return ZZ_VAL;
+
+        zz_t absv = ZZ_CONST_INIT(false, v->size, v->digits);
+        zz_err ret = zz_invert_2exp(u, k, &inv);
+
+        if (!ret) {
+            ret = zz_powm_2exp(&inv, &absv, k, w);
         }
-        u = &o1;
+        zz_clear(&inv);
+        return ret;
+    }
+    if (!v->size) {
+        return zz_set_i64(1, w);
     }
-    if (ISNEG(u) || u->size > w->size) {
-        zz_t tmp;
 
-        if (zz_init(&tmp) || zz_div(u, w, NULL, &tmp)
-            || zz_pos(&tmp, &o1))
-        {
-            /* LCOV_EXCL_START */
-            zz_clear(&tmp);
-            goto end;
-            /* LCOV_EXCL_STOP */
-        }
-        zz_clear(&tmp);
-        u = &o1;
+    /* Even u, raised to v >= k, is zero modulo 2^k */
+    zz_bitcnt_t lsbpos = u->size ? zz_lsbpos(u) : k;
+
+    if (lsbpos && (v->size > 1 || v->digits[0] >= (k - 1)/lsbpos + 1)) {
+        return zz_set_i64(0, w);
     }
-    if (zz_cmp_i64(w, 1) == ZZ_EQ) {
-        ret = zz_set_i64(0, res);
+    if (k > ZZ_BITS_MAX - ZZ_DIGIT_T_BITS) {
+        return ZZ_BUF;
     }
-    else if (!v->size) {
-        ret = zz_set_i64(1, res);
+
+    zz_size_t n = (zz_size_t)((k + ZZ_DIGIT_T_BITS - 1)/ZZ_DIGIT_T_BITS);
+
+    /* For odd u, the order of u modulo 2^k divides 2^k, thus only n low
+       digits of v are used. */
+    zz_size_t vn = MIN(v->size, n);
+
+    while (vn && !v->digits[vn - 1]) {
+        vn--;
     }
-    else if (!u->size) {
-        ret = zz_set_i64(0, res);
+    if (!vn) {
+        return zz_set_i64(1, w);
     }
-    else if (zz_cmp_i64(u, 1) == ZZ_EQ) {
-        ret = zz_set_i64(1, res);
+#if defined(__SIZEOF_INT128__)
+    if (n <= 2) {
+        zz_digit_t t[2];
+        zz_t e = ZZ_CONST_INIT(false, vn, v->digits);
+
+        zz_get_2exp(u, n, t);
+
+        zz_dlimb_t a = n == 2 ? (zz_dlimb_t)t[1] << ZZ_DIGIT_T_BITS : 0;
+
+        a = zz_mod2_pow(a | t[0], &e, zz_bitlen(&e), NULL, false);
+        if (zz_resize(n, w)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
+        }
+        t[0] = (zz_digit_t)a;
+        t[1] = (zz_digit_t)(a >> ZZ_DIGIT_T_BITS);
+        zz_set_2exp(t, n, k, w);
+        return ZZ_OK;
+    }
+#endif
+
+    /* The base, result and scratch space (3n digits) of mpn_powlo() */
+    if (zz_over_budget(5*(double)n)) {
+        return ZZ_LIM;
+    }
+
+    zz_digit_t *volatile tp = TMP_ALLOC((size_t)(5*n) * ZZ_DIGIT_T_BYTES);
+
+    if (!tp || TMP_OVERFLOW) {
+        /* LCOV_EXCL_START */
+err:
+        TMP_FREE(tp);
+        zz_clear(w);
+        return ZZ_MEM;
+        /* LCOV_EXCL_STOP */
+    }
+    zz_get_2exp(u, n, tp);
+    /* mpn_powlo() can't handle v = 1 */
+    if (vn == 1 && v->digits[0] == 1) {
+        mpn_copyi(tp + n, tp, n);
     }
     else {
-        if (_zz_powm(u, v, w, res)) {
-            goto end; /* LCOV_EXCL_LINE */
-        }
+        mpn_powlo(tp + n, tp, v->digits, vn, n, tp + 2*n);
     }
-    if (negativeOutput && !ret && res->size && zz_sub(res, w, res)) {
-        goto end; /* LCOV_EXCL_LINE */
+    if (zz_resize(n, w)) {
+        goto err; /* LCOV_EXCL_LINE */
     }
-    zz_clear(&o1);
-    zz_clear(&o2);
-    zz_clear(&o3);
-    return ret;
+    zz_set_2exp(tp + n, n, k, w);
+    TMP_FREE(tp);
+    return ZZ_OK;
 }
 
 zz_err
 zz_sqrtrem(const zz_t *u, zz_t *v, zz_t *w)
 {
+    STATS_ENTER(ZZ_STATS_SQRT);
+
     if (ISNEG(u)) {
         return ZZ_VAL;
     }
@@ -2599,11 +5468,8 @@ zz_sqrtrem(const zz_t *u, zz_t *v, zz_t *w)
     if (u == v) {
         zz_t tmp;
 
-        if (zz_init(&tmp) || zz_pos(v, &tmp)) {
-            /* LCOV_EXCL_START */
-            zz_clear(&tmp);
-            return ZZ_MEM;
-            /* LCOV_EXCL_STOP */
+        if (zz_save(v, &tmp)) {
+            return ZZ_MEM; /* LCOV_EXCL_LINE */
         }
 
         zz_err ret = zz_sqrtrem(&tmp, v, w);
@@ -2611,7 +5477,30 @@ zz_sqrtrem(const zz_t *u, zz_t *v, zz_t *w)
         zz_clear(&tmp);
         return ret;
     }
-    if (zz_resize((u->size + 1)/2, v) || TMP_OVERFLOW) {
+    if (zz_resize((u->size + 1)/2, v)) {
+        return ZZ_MEM; /* LCOV_EXCL_LINE */
+    }
+    if (u->size == 1) {
+        /* Avoid setjmp() overhead for single-digit inputs */
+        const zz_digit_t half_max = ((zz_digit_t)1 << ZZ_DIGIT_T_BITS/2) - 1;
+        zz_digit_t x = u->digits[0];
+        zz_digit_t s = (zz_digit_t)sqrt((double)x);
+
+        while (s > half_max || s*s > x) {
+            s--;
+        }
+        while (s < half_max && (s + 1)*(s + 1) <= x) {
+            s++;
+        }
+        v->digits[0] = s;
+        if (w) {
+            if (zz_set_u64(x - s*s, w)) {
+                return ZZ_MEM; /* LCOV_EXCL_LINE */
+            }
+        }
+        return ZZ_OK;
+    }
+    if (TMP_OVERFLOW) {
         return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
     if (w) {
@@ -2631,11 +5520,27 @@ zz_sqrtrem(const zz_t *u, zz_t *v, zz_t *w)
 zz_err
 zz_fac(uint64_t u, zz_t *v)
 {
+    STATS_ENTER(ZZ_STATS_COMB);
+
+    static const uint64_t small_fac[] = {
+        1, 1, 2, 6, 24, 120, 720, 5040, 40320, 362880, 3628800, 39916800,
+        479001600, 6227020800, 87178291200, 1307674368000, 20922789888000,
+        355687428096000, 6402373705728000, 121645100408832000,
+        2432902008176640000};
+
+    if (u < sizeof(small_fac)/sizeof(small_fac[0])) {
+        return zz_set_u64(small_fac[u], v);
+    }
 #if ULONG_MAX < ZZ_DIGIT_T_MAX
     if (u > ULONG_MAX) {
         return ZZ_BUF;
     }
 #endif
+    /* The mpz_t result (with less than u*log2(u) bits), its copy and
+       GMP's scratch space */
+    if (zz_over_budget(3*((double)u*log2((double)u)/ZZ_DIGIT_T_BITS + 1))) {
+        return ZZ_LIM;
+    }
     if (TMP_OVERFLOW) {
         return ZZ_MEM;
     }
@@ -2657,11 +5562,22 @@ zz_fac(uint64_t u, zz_t *v)
 zz_err
 zz_bin(uint64_t n, uint64_t k, zz_t *v)
 {
+    STATS_ENTER(ZZ_STATS_COMB);
+
 #if ULONG_MAX < ZZ_DIGIT_T_MAX
     if (n > ULONG_MAX || k > ULONG_MAX) {
         return ZZ_BUF;
     }
 #endif
+    if (k <= n) {
+        /* Result has at most min(n, m*log2(n)) bits, m = min(k, n - k) */
+        double m = (double)MIN(k, n - k);
+        double bits = MIN((double)n, m*log2((double)n));
+
+        if (zz_over_budget(3*(bits/ZZ_DIGIT_T_BITS + 1))) {
+            return ZZ_LIM;
+        }
+    }
     if (TMP_OVERFLOW) {
         return ZZ_MEM; /* LCOV_EXCL_LINE */
     }
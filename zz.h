@@ -17,30 +17,72 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "zz-config.h"
+
 #ifndef __APPLE__
 typedef uint64_t zz_digit_t;
 #else
 typedef unsigned long zz_digit_t;
 #endif
 typedef uint64_t zz_bitcnt_t;
-#ifndef _WIN32
+#if !defined(_WIN32) && !defined(ZZ_COMPACT_HEADER)
 typedef int64_t zz_size_t;
 #else
 typedef int32_t zz_size_t;
 #endif
 
+#ifndef ZZ_COMPACT_HEADER
+/* Number of digits, stored in the zz_t structure itself.  Integers of
+   that size don't require heap allocation for their digits. */
+#define ZZ_INLINE_DIGITS 2
+
 typedef struct {
     bool negative;
+    uint8_t flags;
     zz_size_t alloc;
     zz_size_t size;
     zz_digit_t *digits;
+    zz_digit_t inline_digits[ZZ_INLINE_DIGITS];
 } zz_t;
+#else
+/* Compact layout (16 bytes on 64-bit platforms) for big arrays of integers:
+   capacity, sign and flags are packed in the info field and all digits are
+   stored on the heap. */
+#define ZZ_INLINE_DIGITS 0
+
+typedef struct {
+    uint32_t info;
+    zz_size_t size;
+    zz_digit_t *digits;
+} zz_t;
+#endif
+
+/* Static initializer for read-only integers, that are used only as inputs
+   and never cleared.  The array d holds n digits of the absolute value
+   (least significant first, the last one is non-zero), e.g.:
+
+       static const zz_digit_t d[] = {0, 1};
+       static const zz_t two64 = ZZ_CONST_INIT(false, 2, d);
+
+   Zero capacity marks storage, not owned by the integer. */
+#ifndef ZZ_COMPACT_HEADER
+#  define ZZ_CONST_INIT(neg, n, d) {(neg), 0, 0, (n), (zz_digit_t *)(d), {0}}
+#else
+   /* The sign is bit 27 of the info field. */
+#  define ZZ_CONST_INIT(neg, n, d) \
+    {(neg) ? UINT32_C(1) << 27 : 0, (n), (zz_digit_t *)(d)}
+#endif
+
+/* Range of preconstructed integers, see zz_small(). */
+#define ZZ_SMALL_MIN -256
+#define ZZ_SMALL_MAX 256
 
 typedef enum {
     ZZ_OK = 0,
     ZZ_MEM = -1,
     ZZ_VAL = -2,
     ZZ_BUF = -3,
+    ZZ_LIM = -4,
 } zz_err;
 
 zz_err zz_setup(void);
@@ -48,6 +90,77 @@ void zz_finish(void);
 
 zz_err zz_init(zz_t *u);
 void zz_clear(zz_t *u);
+const zz_t *zz_small(int64_t v);
+
+void zz_set_memory_funcs(void *(*malloc) (size_t),
+                         void *(*realloc) (void *, size_t, size_t),
+                         void (*free) (void *, size_t));
+
+void zz_pool_set_limits(zz_size_t max_digits, size_t max_count);
+void zz_pool_flush(void);
+
+typedef enum {
+    ZZ_GROWTH_DEFAULT = 0,
+    ZZ_GROWTH_EXACT = 1,
+    ZZ_GROWTH_GEOMETRIC = 2,
+} zz_growth;
+
+void zz_set_default_growth(zz_growth policy);
+void zz_set_growth(zz_t *u, zz_growth policy);
+
+zz_err zz_reserve(zz_t *u, zz_size_t size);
+zz_err zz_shrink_to_fit(zz_t *u);
+void zz_set_trim_ratio(unsigned int ratio);
+void zz_set_mmap_threshold(size_t bytes);
+zz_err zz_set_copy_on_write(bool enable);
+void zz_set_memory_budget(size_t bytes);
+
+typedef enum {
+    ZZ_STATS_OTHER = 0,
+    ZZ_STATS_SET,
+    ZZ_STATS_GET_STR,
+    ZZ_STATS_ADD,
+    ZZ_STATS_MUL,
+    ZZ_STATS_DIV,
+    ZZ_STATS_BITWISE,
+    ZZ_STATS_POW,
+    ZZ_STATS_POWM,
+    ZZ_STATS_SQRT,
+    ZZ_STATS_GCD,
+    ZZ_STATS_COMB,
+    ZZ_STATS_OPS,
+} zz_stats_op;
+
+typedef struct {
+    uint64_t allocs;
+    uint64_t reallocs;
+    uint64_t frees;
+    uint64_t bytes;
+    uint64_t scratch_bytes;
+} zz_stats_counters;
+
+typedef struct {
+    int64_t live_bytes;
+    int64_t peak_bytes;
+    zz_stats_counters ops[ZZ_STATS_OPS];
+} zz_stats_t;
+
+void zz_stats_enable(bool enable);
+void zz_stats_get(zz_stats_t *stats);
+void zz_stats_reset(void);
+void zz_stats_merge(zz_stats_t *stats, const zz_stats_t *other);
+
+typedef struct {
+    struct zz_arena_chunk *chunks;
+    zz_digit_t *top;
+    zz_digit_t *end;
+    size_t chunk_size;
+} zz_arena_t;
+
+zz_err zz_arena_init(zz_arena_t *arena, size_t chunk_size);
+void zz_arena_reset(zz_arena_t *arena);
+void zz_arena_clear(zz_arena_t *arena);
+zz_err zz_init_arena(zz_t *u, zz_arena_t *arena);
 
 zz_err zz_set_i32(int32_t u, zz_t *v);
 zz_err zz_set_i64(int64_t u, zz_t *v);
@@ -101,6 +214,163 @@ zz_err zz_mul_u64(const zz_t *u, uint64_t v, zz_t *w);
 zz_err zz_div(const zz_t *u, const zz_t *v, zz_t *q, zz_t *r);
 zz_err zz_div_i64(const zz_t *u, int64_t v, zz_t *q, zz_t *r);
 zz_err zz_i64_div(int64_t u, const zz_t *v, zz_t *q, zz_t *r);
+zz_err zz_quo(const zz_t *u, const zz_t *v, zz_t *q);
+zz_err zz_mod(const zz_t *u, const zz_t *v, zz_t *r);
+zz_err zz_divexact(const zz_t *u, const zz_t *v, zz_t *q);
+zz_err zz_divexact_u64(const zz_t *u, uint64_t v, zz_t *q);
+
+/* Divisor, prepared for repeated division by the same single-digit value,
+   see zz_divisor_u64(). */
+typedef struct {
+    uint64_t d;
+    uint64_t inv;
+    unsigned int shift;
+} zz_divisor_t;
+
+zz_err zz_divisor_u64(uint64_t v, zz_divisor_t *d);
+zz_err zz_div_divisor(const zz_t *u, const zz_divisor_t *d, zz_t *q,
+                      uint64_t *r);
+zz_err zz_quo_divisor(const zz_t *u, const zz_divisor_t *d, zz_t *q);
+uint64_t zz_mod_divisor(const zz_t *u, const zz_divisor_t *d);
+zz_err zz_addmul(const zz_t *u, const zz_t *v, zz_t *w);
+zz_err zz_addmul_i64(const zz_t *u, int64_t v, zz_t *w);
+zz_err zz_addmul_u64(const zz_t *u, uint64_t v, zz_t *w);
+zz_err zz_submul(const zz_t *u, const zz_t *v, zz_t *w);
+zz_err zz_submul_i64(const zz_t *u, int64_t v, zz_t *w);
+zz_err zz_submul_u64(const zz_t *u, uint64_t v, zz_t *w);
+
+#if defined(__SIZEOF_INT128__)
+__extension__ typedef unsigned __int128 zz_dlimb_t;
+#endif
+
+/* Inline fast paths for small operands (up to two digits), that fall back
+   to out-of-line functions otherwise.  They don't allocate memory: results
+   are written only to outputs with inline digits (thus, not for the compact
+   layout), as such storage can't be shared, read-only or too small. */
+#if !defined(ZZ_COMPACT_HEADER) && defined(__SIZEOF_INT128__)
+#  define ZZ_FAST_ARITH 1
+
+static inline bool
+zz_fast_arg(const zz_t *u)
+{
+    return u->size <= 2;
+}
+
+static inline bool
+zz_fast_out(const zz_t *u)
+{
+    return u && u->digits == u->inline_digits;
+}
+
+static inline zz_dlimb_t
+zz_fast_get(const zz_t *u)
+{
+    if (u->size < 2) {
+        return u->size ? u->digits[0] : 0;
+    }
+    return (zz_dlimb_t)u->digits[1] << 64 | u->digits[0];
+}
+
+static inline void
+zz_fast_set(zz_dlimb_t m, bool negative, zz_t *u)
+{
+    u->digits[0] = (zz_digit_t)m;
+    u->digits[1] = (zz_digit_t)(m >> 64);
+    u->size = u->digits[1] ? 2 : u->digits[0] != 0;
+    u->negative = negative && u->size;
+}
+
+/* Set w to u + v (or u - v), where signs of operands are given separately.
+   Return false, if the result doesn't fit in two digits. */
+static inline bool
+zz_fast_addsub(const zz_t *u, const zz_t *v, bool v_negative, zz_t *w)
+{
+    zz_dlimb_t a = zz_fast_get(u), b = zz_fast_get(v);
+    bool u_negative = u->negative;
+
+    if (u_negative == v_negative) {
+        if (a + b < a) {
+            return false;
+        }
+        zz_fast_set(a + b, u_negative, w);
+    }
+    else if (a >= b) {
+        zz_fast_set(a - b, u_negative, w);
+    }
+    else {
+        zz_fast_set(b - a, v_negative, w);
+    }
+    return true;
+}
+#endif
+
+static inline zz_err
+zz_fast_add(const zz_t *u, const zz_t *v, zz_t *w)
+{
+#if ZZ_FAST_ARITH
+    if (zz_fast_arg(u) && zz_fast_arg(v) && zz_fast_out(w)
+        && zz_fast_addsub(u, v, v->negative, w))
+    {
+        return ZZ_OK;
+    }
+#endif
+    return zz_add(u, v, w);
+}
+
+static inline zz_err
+zz_fast_sub(const zz_t *u, const zz_t *v, zz_t *w)
+{
+#if ZZ_FAST_ARITH
+    if (zz_fast_arg(u) && zz_fast_arg(v) && zz_fast_out(w)
+        && zz_fast_addsub(u, v, !v->negative, w))
+    {
+        return ZZ_OK;
+    }
+#endif
+    return zz_sub(u, v, w);
+}
+
+static inline zz_err
+zz_fast_mul(const zz_t *u, const zz_t *v, zz_t *w)
+{
+#if ZZ_FAST_ARITH
+    if (zz_fast_arg(u) && zz_fast_arg(v) && zz_fast_out(w)) {
+        zz_dlimb_t p;
+        bool negative = u->negative != v->negative;
+
+        if (!__builtin_mul_overflow(zz_fast_get(u), zz_fast_get(v), &p)) {
+            zz_fast_set(p, negative, w);
+            return ZZ_OK;
+        }
+    }
+#endif
+    return zz_mul(u, v, w);
+}
+
+static inline zz_err
+zz_fast_div(const zz_t *u, const zz_t *v, zz_t *q, zz_t *r)
+{
+#if ZZ_FAST_ARITH
+    if (zz_fast_arg(u) && zz_fast_arg(v) && v->size && zz_fast_out(q)
+        && zz_fast_out(r) && q != r)
+    {
+        zz_dlimb_t a = zz_fast_get(u), b = zz_fast_get(v);
+        zz_dlimb_t qm = a / b, rm = a % b;
+        bool negative = u->negative != v->negative, r_negative = v->negative;
+
+        /* Round quotient towards minus infinity, qm + 1 can't overflow
+           as rm == 0 for b == 1 */
+        if (negative && rm) {
+            qm++;
+            rm = b - rm;
+        }
+        zz_fast_set(qm, negative, q);
+        zz_fast_set(rm, r_negative, r);
+        return ZZ_OK;
+    }
+#endif
+    return zz_div(u, v, q, r);
+}
 
 static inline zz_err
 zz_i64_add(int64_t u, const zz_t *v, zz_t *w)
@@ -147,7 +417,7 @@ zz_u64_mul(uint64_t u, const zz_t *v, zz_t *w)
                                unsigned int: zz_add_u64,        \
                                unsigned long: zz_add_u64,       \
                                unsigned long long: zz_add_u64,  \
-                               default: zz_add))(U, V, W)
+                               default: zz_fast_add))(U, V, W)
 #define zz_sub(U, V, W)                                         \
     _Generic((U),                                               \
              int: _Generic((V),                                 \
@@ -169,7 +439,7 @@ zz_u64_mul(uint64_t u, const zz_t *v, zz_t *w)
                                unsigned int: zz_sub_u64,        \
                                unsigned long: zz_sub_u64,       \
                                unsigned long long: zz_sub_u64,  \
-                               default: zz_sub))(U, V, W)
+                               default: zz_fast_sub))(U, V, W)
 #define zz_mul(U, V, W)                                         \
     _Generic((U),                                               \
              int: _Generic((V),                                 \
@@ -191,7 +461,7 @@ zz_u64_mul(uint64_t u, const zz_t *v, zz_t *w)
                                unsigned int: zz_mul_u64,        \
                                unsigned long: zz_mul_u64,       \
                                unsigned long long: zz_mul_u64,  \
-                               default: zz_mul))(U, V, W)
+                               default: zz_fast_mul))(U, V, W)
 #define zz_div(U, V, Q, R)                                   \
     _Generic((U),                                            \
              int: _Generic((V),                              \
@@ -204,10 +474,73 @@ zz_u64_mul(uint64_t u, const zz_t *v, zz_t *w)
                                int: zz_div_i64,              \
                                long: zz_div_i64,             \
                                long long: zz_div_i64,        \
-                               default: zz_div))(U, V, Q, R)
+                               default: zz_fast_div))(U, V, Q, R)
+#define zz_addmul(U, V, W)                                \
+    _Generic((V),                                         \
+             int: zz_addmul_i64,                          \
+             long: zz_addmul_i64,                         \
+             long long: zz_addmul_i64,                    \
+             unsigned int: zz_addmul_u64,                 \
+             unsigned long: zz_addmul_u64,                \
+             unsigned long long: zz_addmul_u64,           \
+             default: zz_addmul)(U, V, W)
+#define zz_submul(U, V, W)                                \
+    _Generic((V),                                         \
+             int: zz_submul_i64,                          \
+             long: zz_submul_i64,                         \
+             long long: zz_submul_i64,                    \
+             unsigned int: zz_submul_u64,                 \
+             unsigned long: zz_submul_u64,                \
+             unsigned long long: zz_submul_u64,           \
+             default: zz_submul)(U, V, W)
 
 zz_err zz_pow(const zz_t *u, uint64_t v, zz_t *w);
 zz_err zz_powm(const zz_t *u, const zz_t *v, const zz_t *w, zz_t *x);
+zz_err zz_powm_2exp(const zz_t *u, const zz_t *v, zz_bitcnt_t k, zz_t *w);
+zz_err zz_invert_2exp(const zz_t *u, zz_bitcnt_t k, zz_t *w);
+
+/* Context for arithmetic modulo fixed m, see zz_mod_ctx_init().  All data
+   is precomputed at once, so the context can be shared between threads. */
+typedef struct {
+    zz_t m;
+    zz_t norm;      /* m, shifted to set the highest bit of the top digit */
+    zz_t odd;       /* odd part of m */
+    zz_t inv;       /* odd^-1 mod 2^lsbpos, if m is even */
+    zz_divisor_t digit;
+    zz_digit_t dinv;
+    zz_bitcnt_t lsbpos;
+    unsigned int shift;
+} zz_mod_ctx_t;
+
+zz_err zz_mod_ctx_init(zz_mod_ctx_t *ctx, const zz_t *m);
+void zz_mod_ctx_clear(zz_mod_ctx_t *ctx);
+zz_err zz_mod_reduce(const zz_t *u, const zz_mod_ctx_t *ctx, zz_t *r);
+zz_err zz_mod_add(const zz_t *u, const zz_t *v, const zz_mod_ctx_t *ctx,
+                  zz_t *w);
+zz_err zz_mod_sub(const zz_t *u, const zz_t *v, const zz_mod_ctx_t *ctx,
+                  zz_t *w);
+zz_err zz_mod_mul(const zz_t *u, const zz_t *v, const zz_mod_ctx_t *ctx,
+                  zz_t *w);
+zz_err zz_mod_sqr(const zz_t *u, const zz_mod_ctx_t *ctx, zz_t *w);
+zz_err zz_mod_pow(const zz_t *u, const zz_t *v, const zz_mod_ctx_t *ctx,
+                  zz_t *w);
+zz_err zz_mod_pow_multi(const zz_t *const *u, const zz_t *const *v, size_t n,
+                        const zz_mod_ctx_t *ctx, zz_t *w);
+
+/* Precomputed powers of a fixed base, see zz_powm_table_init(). */
+typedef struct {
+    const zz_mod_ctx_t *ctx;
+    zz_t *table;
+    size_t size;
+    zz_bitcnt_t bits;
+    unsigned int window;
+} zz_powm_table_t;
+
+zz_err zz_powm_table_init(zz_powm_table_t *t, const zz_t *u,
+                          const zz_mod_ctx_t *ctx, zz_bitcnt_t bits,
+                          unsigned int window);
+void zz_powm_table_clear(zz_powm_table_t *t);
+zz_err zz_powm_table(const zz_powm_table_t *t, const zz_t *v, zz_t *w);
 
 typedef enum {
     ZZ_GT = +1,
@@ -218,13 +551,84 @@ typedef enum {
 zz_ord zz_cmp(const zz_t *u, const zz_t *v);
 zz_ord zz_cmp_i64(const zz_t *u, int64_t v);
 
-#define zz_cmp(U, V)                                   \
-    _Generic((U),                                      \
-             default: _Generic((V),                    \
-                               int: zz_cmp_i64,        \
-                               long: zz_cmp_i64,       \
-                               long long: zz_cmp_i64,  \
-                               default: zz_cmp))(U, V)
+bool zz_iszero(const zz_t *u);
+bool zz_isneg(const zz_t *u);
+bool zz_isodd(const zz_t *u);
+
+static inline bool
+zz_fast_iszero(const zz_t *u)
+{
+    return u->size == 0;
+}
+
+static inline bool
+zz_fast_isneg(const zz_t *u)
+{
+#ifndef ZZ_COMPACT_HEADER
+    return u->negative;
+#else
+    /* The sign is bit 27 of the info field. */
+    return u->info >> 27 & 1;
+#endif
+}
+
+static inline bool
+zz_fast_isodd(const zz_t *u)
+{
+    return u->size && u->digits[0] & 1;
+}
+
+#define zz_iszero(U) zz_fast_iszero(U)
+#define zz_isneg(U) zz_fast_isneg(U)
+#define zz_isodd(U) zz_fast_isodd(U)
+
+/* Compare magnitudes a and b of single-digit integers with same signs. */
+static inline zz_ord
+zz_fast_cmp_digits(zz_digit_t a, zz_digit_t b, bool negative)
+{
+    zz_ord r = a > b ? ZZ_GT : (a < b ? ZZ_LT : ZZ_EQ);
+
+    return negative ? (zz_ord)-r : r;
+}
+
+static inline zz_ord
+zz_fast_cmp(const zz_t *u, const zz_t *v)
+{
+    if (u->size <= 1 && v->size <= 1) {
+        bool u_negative = zz_fast_isneg(u);
+
+        if (u_negative != zz_fast_isneg(v)) {
+            return u_negative ? ZZ_LT : ZZ_GT;
+        }
+        return zz_fast_cmp_digits(u->size ? u->digits[0] : 0,
+                                  v->size ? v->digits[0] : 0, u_negative);
+    }
+    return zz_cmp(u, v);
+}
+
+static inline zz_ord
+zz_fast_cmp_i64(const zz_t *u, int64_t v)
+{
+    if (u->size <= 1) {
+        bool u_negative = zz_fast_isneg(u);
+
+        if (u_negative != (v < 0)) {
+            return u_negative ? ZZ_LT : ZZ_GT;
+        }
+        return zz_fast_cmp_digits(u->size ? u->digits[0] : 0,
+                                  v < 0 ? -(zz_digit_t)v : (zz_digit_t)v,
+                                  u_negative);
+    }
+    return zz_cmp_i64(u, v);
+}
+
+#define zz_cmp(U, V)                                        \
+    _Generic((U),                                           \
+             default: _Generic((V),                         \
+                               int: zz_fast_cmp_i64,        \
+                               long: zz_fast_cmp_i64,       \
+                               long long: zz_fast_cmp_i64,  \
+                               default: zz_fast_cmp))(U, V)
 
 zz_err zz_invert(const zz_t *u, zz_t *v);
 zz_err zz_and(const zz_t *u, const zz_t *v, zz_t *w);
@@ -256,9 +660,6 @@ zz_err zz_sizeinbase(const zz_t *u, int base, size_t *size);
 zz_bitcnt_t zz_bitlen(const zz_t *u);
 zz_bitcnt_t zz_lsbpos(const zz_t *u);
 zz_bitcnt_t zz_bitcnt(const zz_t *u);
-bool zz_iszero(const zz_t *u);
-bool zz_isneg(const zz_t *u);
-bool zz_isodd(const zz_t *u);
 
 size_t zz_sizeof(const zz_t *u);
 